@@ -0,0 +1,278 @@
+/*
+ * gc_pause.c
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * GC pause-latency benchmark. Builds a long-lived synthetic heap of a given
+ * shape, then allocates short-lived objects of the same shape at a controlled
+ * rate and records the duration of every collection this triggers. Reports
+ * pause percentiles and the overall GC overhead as JSON.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gc.h"
+#include "heap.h"
+#include "list.h"
+#include "map.h"
+#include "value.h"
+
+typedef enum { SHAPE_LIST, SHAPE_MAP, SHAPE_TREE, SHAPE_MIXED } Shape;
+
+static const char* shape_names[] = { "list", "map", "tree", "mixed" };
+
+typedef struct Pauses {
+    uint64_t* ns;
+    size_t size;
+    size_t capacity;
+} Pauses;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static void pauses_push(Pauses* p, uint64_t ns)
+{
+    if (p->size == p->capacity) {
+        p->capacity = p->capacity ? 2 * p->capacity : 1024;
+        p->ns = realloc(p->ns, p->capacity * sizeof(uint64_t));
+    }
+    p->ns[p->size++] = ns;
+}
+
+static int compare_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+static Pauses pauses;
+
+static void record_pause(GarbageCollector* gc)
+{
+    pauses_push(&pauses, gc->stats.last_pause_ns);
+}
+
+static uint64_t percentile(Pauses* p, double q)
+{
+    if (!p->size) return 0;
+    size_t i = (size_t) (q * (p->size - 1) + 0.5);
+    return p->ns[i];
+}
+
+/*
+ * Heap shapes. Each builder returns the root of a structure with roughly
+ * `n` objects, built from the interpreter's own data structures.
+ */
+static void* build_list(size_t n)
+{
+    List* l = list_new();
+    for (size_t i = 0; i < n; ++i) {
+        list_append(l, value_new_int(i));
+    }
+    return l;
+}
+
+static void* build_map(size_t n)
+{
+    Map* m = map_new(n);
+    char key[32];
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(key, sizeof(key), "key-%zu", i);
+        map_put(m, symbol_intern(key), value_new_int(i));
+    }
+    return m;
+}
+
+static Value* build_tree(size_t n)
+{
+    /* a binary tree of nested (value left right) lists */
+    Value* node = value_new_list();
+    list_append(node->value.list, value_new_int(n));
+    if (n > 1) {
+        size_t left = (n - 1) / 2;
+        list_append(node->value.list, build_tree(left));
+        if (n - 1 - left > 0) {
+            list_append(node->value.list, build_tree(n - 1 - left));
+        }
+    }
+    return node;
+}
+
+static void* build_mixed(size_t n)
+{
+    /* a chain of blocks between 16 bytes and 4 KiB */
+    void** head = NULL;
+    for (size_t i = 0; i < n; ++i) {
+        size_t size = 16 << (rand() % 9);
+        void** block = gc_malloc(&gc, size);
+        memset(block, 0, size);
+        block[0] = head;
+        head = block;
+    }
+    return head;
+}
+
+static void* build(Shape shape, size_t n)
+{
+    switch (shape) {
+    case SHAPE_LIST:
+        return build_list(n);
+    case SHAPE_MAP:
+        return build_map(n);
+    case SHAPE_TREE:
+        return build_tree(n);
+    case SHAPE_MIXED:
+        return build_mixed(n);
+    }
+    return NULL;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --shape=list|map|tree|mixed  heap shape (default: list)\n"
+            "  --live=N          objects in the long-lived heap (default: 10000)\n"
+            "  --allocs=N        short-lived structures to allocate (default: 100000)\n"
+            "  --unit=N          objects per short-lived structure (default: 8)\n"
+            "  --rate=N          structures per second, 0 is unthrottled (default: 0)\n"
+            "  --capacity=N      initial allocation map capacity (default: 1024)\n"
+            "  --min-capacity=N  minimum allocation map capacity (default: 1024)\n"
+            "  --downsize=F      allocation map downsize load factor (default: 0.2)\n"
+            "  --upsize=F        allocation map upsize load factor (default: 0.8)\n"
+            "  --sweep=F         sweep factor (default: 0.5)\n"
+            "  --heap=MIB        allocate objects from a reserved heap of this size\n"
+            "  --huge-pages      back the heap with transparent huge pages\n"
+            "  --numa-node=N     bind the heap to NUMA node N\n",
+            prog);
+}
+
+int main(int argc, char* argv[])
+{
+    Shape shape = SHAPE_LIST;
+    size_t live = 10000, allocs = 100000, unit = 8;
+    double rate = 0.0;
+    size_t capacity = 1024, min_capacity = 1024;
+    double downsize = 0.2, upsize = 0.8, sweep = 0.5;
+    size_t heap_size = 0;
+    int heap_flags = 0, numa_node = -1;
+
+    static struct option options[] = {
+        { "shape", required_argument, NULL, 'S' },
+        { "live", required_argument, NULL, 'l' },
+        { "allocs", required_argument, NULL, 'a' },
+        { "unit", required_argument, NULL, 'n' },
+        { "rate", required_argument, NULL, 'r' },
+        { "capacity", required_argument, NULL, 'c' },
+        { "min-capacity", required_argument, NULL, 'm' },
+        { "downsize", required_argument, NULL, 'd' },
+        { "upsize", required_argument, NULL, 'u' },
+        { "sweep", required_argument, NULL, 's' },
+        { "heap", required_argument, NULL, 'H' },
+        { "huge-pages", no_argument, NULL, 'P' },
+        { "numa-node", required_argument, NULL, 'N' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'S':
+            for (shape = SHAPE_LIST; shape <= SHAPE_MIXED; ++shape) {
+                if (strcmp(optarg, shape_names[shape]) == 0) break;
+            }
+            if (shape > SHAPE_MIXED) {
+                fprintf(stderr, "Unknown shape: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'l': live = strtoul(optarg, NULL, 10); break;
+        case 'a': allocs = strtoul(optarg, NULL, 10); break;
+        case 'n': unit = strtoul(optarg, NULL, 10); break;
+        case 'r': rate = strtod(optarg, NULL); break;
+        case 'c': capacity = strtoul(optarg, NULL, 10); break;
+        case 'm': min_capacity = strtoul(optarg, NULL, 10); break;
+        case 'd': downsize = strtod(optarg, NULL); break;
+        case 'u': upsize = strtod(optarg, NULL); break;
+        case 's': sweep = strtod(optarg, NULL); break;
+        case 'H': heap_size = strtoul(optarg, NULL, 10) << 20; break;
+        case 'P': heap_flags |= HEAP_HUGE_PAGES; break;
+        case 'N':
+            numa_node = atoi(optarg);
+            heap_flags |= HEAP_NUMA_BIND;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    Heap* heap = NULL;
+    if (heap_size && !(heap = heap_new(heap_size, heap_flags, numa_node))) {
+        fprintf(stderr, "Failed to reserve a heap of %zu bytes\n", heap_size);
+        return 1;
+    }
+    int bos;
+    gc_start_ext(&gc, &bos, capacity, min_capacity, downsize, upsize, sweep, heap);
+    srand(42);
+
+    /* long-lived heap */
+    gc_make_root(&gc, build(shape, live));
+    size_t warmup_runs = gc.stats.runs;
+    uint64_t warmup_pause_ns = gc.stats.total_pause_ns;
+
+    /* short-lived churn, paced to the requested rate */
+    gc.on_run = record_pause;
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < allocs; ++i) {
+        build(shape, unit);
+        if (rate > 0.0) {
+            uint64_t due = start + (uint64_t) (1e9 * (i + 1) / rate);
+            uint64_t t = now_ns();
+            if (due > t) {
+                struct timespec ts = { (due - t) / 1000000000u, (due - t) % 1000000000u };
+                nanosleep(&ts, NULL);
+            }
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+    gc.on_run = NULL;
+    uint64_t pause_total = gc.stats.total_pause_ns - warmup_pause_ns;
+    qsort(pauses.ns, pauses.size, sizeof(uint64_t), compare_u64);
+
+    printf("{\n");
+    printf("  \"shape\": \"%s\",\n", shape_names[shape]);
+    printf("  \"live\": %zu,\n", live);
+    printf("  \"allocs\": %zu,\n", allocs);
+    printf("  \"unit\": %zu,\n", unit);
+    printf("  \"rate\": %.1f,\n", rate);
+    printf("  \"config\": { \"capacity\": %zu, \"min_capacity\": %zu, \"downsize\": %g, "
+           "\"upsize\": %g, \"sweep\": %g },\n",
+           capacity, min_capacity, downsize, upsize, sweep);
+    printf("  \"heap\": { \"bytes\": %zu, \"huge_pages\": %s, \"numa_node\": %d },\n",
+           heap_size, (heap_flags & HEAP_HUGE_PAGES) ? "true" : "false", numa_node);
+    printf("  \"warmup_collections\": %zu,\n", warmup_runs);
+    printf("  \"collections\": %zu,\n", pauses.size);
+    printf("  \"pause_ns\": { \"p50\": %lu, \"p99\": %lu, \"p99.9\": %lu, \"max\": %lu, "
+           "\"mean\": %lu },\n",
+           (unsigned long) percentile(&pauses, 0.5),
+           (unsigned long) percentile(&pauses, 0.99),
+           (unsigned long) percentile(&pauses, 0.999),
+           (unsigned long) (pauses.size ? pauses.ns[pauses.size - 1] : 0),
+           (unsigned long) (pauses.size ? pause_total / pauses.size : 0));
+    printf("  \"gc_overhead\": %.4f,\n", elapsed ? (double) pause_total / elapsed : 0.0);
+    printf("  \"seconds\": %.6f\n", elapsed * 1e-9);
+    printf("}\n");
+
+    free(pauses.ns);
+    return 0;
+}
@@ -0,0 +1,236 @@
+/*
+ * gc_replay.c
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * Replays an allocation trace recorded with gc_trace_start() against a
+ * freshly configured garbage collector, without the interpreter in the loop.
+ *
+ * Live objects are held in a rooted slot table indexed by trace id. Objects
+ * that the original program freed explicitly are gc_free()'d, objects that
+ * the original collector swept are merely dropped from the table, so that
+ * the replayed collector reclaims them whenever its own policy says so.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gc.h"
+#include "heap.h"
+
+typedef struct Replay {
+    GarbageCollector* gc;
+    void** slots;             // live objects, indexed by trace id
+    size_t capacity;
+    uint64_t last_id;
+    bool honor_runs;          // also collect where the trace collected
+    /* statistics */
+    size_t events;
+    size_t allocs;
+    size_t frees;
+    size_t drops;
+    size_t runs;
+    size_t live;
+    size_t peak_live;
+    uint64_t lifetime_sum;    // in allocations, over all dead objects
+} Replay;
+
+static int read_varint(FILE* in, uint64_t* v)
+{
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = getc(in);
+        if (c == EOF) return -1;
+        *v |= ((uint64_t) (c & 0x7f)) << shift;
+        if (!(c & 0x80)) return 0;
+    }
+    return -1;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void replay_store(Replay* r, void* ptr)
+{
+    uint64_t id = ++r->last_id;
+    if (id >= r->capacity) {
+        size_t capacity = r->capacity * 2;
+        void** slots = gc_realloc(r->gc, r->slots, capacity * sizeof(void*));
+        if (!slots) {
+            fprintf(stderr, "Failed to grow slot table: %s\n", strerror(errno));
+            exit(1);
+        }
+        memset(slots + r->capacity, 0, (capacity - r->capacity) * sizeof(void*));
+        r->slots = slots;
+        r->capacity = capacity;
+    }
+    r->slots[id] = ptr;
+    r->allocs++;
+    if (++r->live > r->peak_live) r->peak_live = r->live;
+}
+
+static void* replay_take(Replay* r, uint64_t id)
+{
+    if (id == 0 || id > r->last_id) {
+        fprintf(stderr, "Corrupt trace: unknown allocation id %lu\n", (unsigned long) id);
+        exit(1);
+    }
+    void* ptr = r->slots[id];
+    if (!ptr) {
+        fprintf(stderr, "Corrupt trace: allocation id %lu is not live\n", (unsigned long) id);
+        exit(1);
+    }
+    r->slots[id] = NULL;
+    r->live--;
+    r->lifetime_sum += r->last_id - id;
+    return ptr;
+}
+
+static int replay_event(Replay* r, int event, FILE* in)
+{
+    uint64_t a, b;
+    switch (event) {
+    case GC_TRACE_MALLOC:
+        if (read_varint(in, &a)) return -1;
+        replay_store(r, gc_malloc(r->gc, a));
+        break;
+    case GC_TRACE_CALLOC:
+        if (read_varint(in, &a) || read_varint(in, &b)) return -1;
+        replay_store(r, gc_calloc(r->gc, a, b));
+        break;
+    case GC_TRACE_REALLOC:
+        if (read_varint(in, &a) || read_varint(in, &b)) return -1;
+        void* p = a ? replay_take(r, r->last_id + 1 - a) : NULL;
+        replay_store(r, gc_realloc(r->gc, p, b));
+        break;
+    case GC_TRACE_FREE:
+        if (read_varint(in, &a)) return -1;
+        gc_free(r->gc, replay_take(r, r->last_id - a));
+        r->frees++;
+        break;
+    case GC_TRACE_SWEEP:
+        if (read_varint(in, &a)) return -1;
+        replay_take(r, r->last_id - a);
+        r->drops++;
+        break;
+    case GC_TRACE_RUN:
+        r->runs++;
+        if (r->honor_runs) gc_run(r->gc);
+        break;
+    default:
+        return -1;
+    }
+    r->events++;
+    return 0;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "usage: %s [-c initial_capacity] [-m min_capacity] [-d downsize_factor]\n"
+            "          [-u upsize_factor] [-s sweep_factor] [-H heap_mib [-P] [-N node]]\n"
+            "          [-r] trace\n"
+            "\n"
+            "  -H  allocate objects from a reserved heap of this many MiB\n"
+            "  -P  back the heap with transparent huge pages\n"
+            "  -N  bind the heap to this NUMA node\n"
+            "  -r  additionally collect wherever the recorded program collected\n",
+            prog);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t initial_capacity = 1024, min_capacity = 1024;
+    double downsize = 0.2, upsize = 0.8, sweep = 0.5;
+    bool honor_runs = false;
+    size_t heap_size = 0;
+    int heap_flags = 0, numa_node = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:m:d:u:s:H:PN:rh")) != -1) {
+        switch (opt) {
+        case 'c': initial_capacity = strtoul(optarg, NULL, 10); break;
+        case 'm': min_capacity = strtoul(optarg, NULL, 10); break;
+        case 'd': downsize = strtod(optarg, NULL); break;
+        case 'u': upsize = strtod(optarg, NULL); break;
+        case 's': sweep = strtod(optarg, NULL); break;
+        case 'H': heap_size = strtoul(optarg, NULL, 10) << 20; break;
+        case 'P': heap_flags |= HEAP_HUGE_PAGES; break;
+        case 'N':
+            numa_node = atoi(optarg);
+            heap_flags |= HEAP_NUMA_BIND;
+            break;
+        case 'r': honor_runs = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+    FILE* in = fopen(argv[optind], "rb");
+    if (!in) {
+        fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    char magic[sizeof(GC_TRACE_MAGIC)] = { 0 };
+    if (fread(magic, 1, strlen(GC_TRACE_MAGIC), in) != strlen(GC_TRACE_MAGIC)
+            || strcmp(magic, GC_TRACE_MAGIC) != 0) {
+        fprintf(stderr, "%s: not an allocation trace\n", argv[optind]);
+        return 1;
+    }
+
+    Heap* heap = NULL;
+    if (heap_size && !(heap = heap_new(heap_size, heap_flags, numa_node))) {
+        fprintf(stderr, "Failed to reserve a heap of %zu bytes\n", heap_size);
+        return 1;
+    }
+    int bos;
+    GarbageCollector collector;
+    gc_start_ext(&collector, &bos, initial_capacity, min_capacity, downsize, upsize, sweep,
+                 heap);
+
+    Replay r = { .gc = &collector, .capacity = 1024, .honor_runs = honor_runs };
+    r.slots = gc_make_root(&collector, gc_calloc(&collector, r.capacity, sizeof(void*)));
+
+    int event;
+    double start = now();
+    while ((event = getc(in)) != EOF) {
+        if (replay_event(&r, event, in)) {
+            fprintf(stderr, "%s: corrupt trace after %zu events\n", argv[optind], r.events);
+            return 1;
+        }
+    }
+    double elapsed = now() - start;
+    fclose(in);
+
+    size_t dead = r.frees + r.drops;
+    printf("{\n");
+    printf("  \"events\": %zu,\n", r.events);
+    printf("  \"allocations\": %zu,\n", r.allocs);
+    printf("  \"frees\": %zu,\n", r.frees);
+    printf("  \"collected\": %zu,\n", r.drops);
+    printf("  \"recorded_runs\": %zu,\n", r.runs);
+    printf("  \"peak_live\": %zu,\n", r.peak_live);
+    printf("  \"mean_lifetime\": %.1f,\n", dead ? (double) r.lifetime_sum / dead : 0.0);
+    printf("  \"collections\": %zu,\n", collector.stats.runs);
+    printf("  \"pause_seconds\": %.6f,\n", collector.stats.total_pause_ns * 1e-9);
+    printf("  \"seconds\": %.6f\n", elapsed);
+    printf("}\n");
+
+    gc_stop(&collector);
+    if (heap) {
+        heap_delete(heap);
+    }
+    return 0;
+}
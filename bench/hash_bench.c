@@ -0,0 +1,270 @@
+/*
+ * hash_bench.c
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * String hash benchmark. Hashes a corpus of keys with every candidate hash
+ * function and reports throughput as well as how evenly the hashes spread
+ * over the low bits that the symbol table and Map index by. Reports JSON.
+ *
+ * The built-in corpora mimic what the interpreter hashes: short symbol
+ * names and generated map keys. --words reads one key per line instead.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "djb2.h"
+#include "hash.h"
+
+typedef struct Corpus {
+    char** keys;
+    size_t* lengths;
+    size_t size;
+    size_t capacity;
+    size_t bytes;
+} Corpus;
+
+typedef struct Hasher {
+    const char* name;
+    uint64_t (*hash)(const char* key, size_t len);
+} Hasher;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t hash_djb2(const char* key, size_t len)
+{
+    (void) len;
+    return djb2((char*) key);
+}
+
+static uint64_t hash_djb2_mixed(const char* key, size_t len)
+{
+    (void) len;
+    uint64_t hash = (uint64_t) djb2((char*) key) * 0x9e3779b97f4a7c15ULL;
+    return hash ^ (hash >> 32);
+}
+
+static uint64_t hash_seeded(const char* key, size_t len)
+{
+    return hash_bytes(key, len, HASH_SEED);
+}
+
+static const Hasher hashers[] = {
+    { "djb2", hash_djb2 },
+    { "djb2-mixed", hash_djb2_mixed },
+    { "wyhash", hash_seeded },
+};
+
+static void corpus_push(Corpus* c, const char* key)
+{
+    if (c->size == c->capacity) {
+        c->capacity = c->capacity ? 2 * c->capacity : 1024;
+        c->keys = realloc(c->keys, c->capacity * sizeof(char*));
+        c->lengths = realloc(c->lengths, c->capacity * sizeof(size_t));
+    }
+    size_t len = strlen(key);
+    c->keys[c->size] = strdup(key);
+    c->lengths[c->size] = len;
+    c->bytes += len;
+    c->size++;
+}
+
+/* Distinct identifiers as they show up in programs: words, dashes and counters */
+static void corpus_symbols(Corpus* c, size_t n)
+{
+    static const char* words[] = {
+        "list", "map", "get", "set", "make", "count", "first", "rest", "key",
+        "value", "node", "tree", "acc", "fn", "let", "index", "sum", "x", "y", "n"
+    };
+    size_t nwords = sizeof(words) / sizeof(words[0]);
+    char key[64];
+    for (size_t i = 0; i < n; ++i) {
+        size_t a = i % nwords, b = (i / nwords) % nwords;
+        switch (i / (nwords * nwords) % 3) {
+        case 0:
+            snprintf(key, sizeof(key), "%s-%s%zu", words[a], words[b], i / (nwords * nwords));
+            break;
+        case 1:
+            snprintf(key, sizeof(key), "%s%zu", words[a], i / nwords);
+            break;
+        default:
+            snprintf(key, sizeof(key), "%s-%s-%zu", words[a], words[b], i);
+            break;
+        }
+        corpus_push(c, key);
+    }
+}
+
+/* The keys gc_pause puts into its maps */
+static void corpus_keys(Corpus* c, size_t n)
+{
+    char key[32];
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(key, sizeof(key), "key-%zu", i);
+        corpus_push(c, key);
+    }
+}
+
+static int corpus_read(Corpus* c, const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0]) {
+            corpus_push(c, line);
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+/*
+ * Buckets the keys by the low bits of their hash into a power of 2 table
+ * at load 1/2, like the symbol table, and compares the number of occupied
+ * buckets and the chi-squared statistic against a uniform random hash.
+ */
+static void distribution(const Corpus* c, const Hasher* h, double* occupancy, double* chi2,
+                         size_t* max_load)
+{
+    size_t buckets = 1;
+    while (buckets < 2 * c->size) {
+        buckets *= 2;
+    }
+    size_t* counts = calloc(buckets, sizeof(size_t));
+    for (size_t i = 0; i < c->size; ++i) {
+        counts[h->hash(c->keys[i], c->lengths[i]) & (buckets - 1)]++;
+    }
+    double expected = (double) c->size / buckets;
+    double sum = 0.0;
+    size_t occupied = 0;
+    *max_load = 0;
+    for (size_t i = 0; i < buckets; ++i) {
+        double d = counts[i] - expected;
+        sum += d * d / expected;
+        occupied += counts[i] > 0;
+        if (counts[i] > *max_load) {
+            *max_load = counts[i];
+        }
+    }
+    /* a uniform hash leaves buckets * (1 - 1/buckets)^n buckets empty */
+    double ideal = buckets;
+    for (size_t i = 0; i < c->size; ++i) {
+        ideal *= 1.0 - 1.0 / buckets;
+    }
+    *occupancy = occupied / (buckets - ideal);
+    *chi2 = sum / (buckets - 1);
+    free(counts);
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --corpus=symbols|keys  built-in corpus (default: symbols)\n"
+            "  --words=FILE      hash the lines of FILE instead\n"
+            "  --size=N          keys in the built-in corpus (default: 100000)\n"
+            "  --rounds=N        passes over the corpus per hash (default: 50)\n",
+            prog);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* corpus_name = "symbols";
+    const char* words = NULL;
+    size_t size = 100000, rounds = 50;
+
+    static struct option options[] = {
+        { "corpus", required_argument, NULL, 'c' },
+        { "words", required_argument, NULL, 'w' },
+        { "size", required_argument, NULL, 'n' },
+        { "rounds", required_argument, NULL, 'r' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'c': corpus_name = optarg; break;
+        case 'w': words = optarg; break;
+        case 'n': size = strtoul(optarg, NULL, 10); break;
+        case 'r': rounds = strtoul(optarg, NULL, 10); break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    Corpus corpus = { NULL, NULL, 0, 0, 0 };
+    if (words) {
+        if (corpus_read(&corpus, words) != 0) {
+            fprintf(stderr, "Failed to read %s\n", words);
+            return 1;
+        }
+        corpus_name = words;
+    } else if (strcmp(corpus_name, "symbols") == 0) {
+        corpus_symbols(&corpus, size);
+    } else if (strcmp(corpus_name, "keys") == 0) {
+        corpus_keys(&corpus, size);
+    } else {
+        fprintf(stderr, "Unknown corpus: %s\n", corpus_name);
+        return 2;
+    }
+    if (!corpus.size || !rounds) {
+        fprintf(stderr, "Nothing to hash\n");
+        return 2;
+    }
+
+    size_t nhashers = sizeof(hashers) / sizeof(hashers[0]);
+    printf("{\n");
+    printf("  \"corpus\": \"%s\",\n", corpus_name);
+    printf("  \"keys\": %zu,\n", corpus.size);
+    printf("  \"mean_length\": %.2f,\n", (double) corpus.bytes / corpus.size);
+    printf("  \"rounds\": %zu,\n", rounds);
+    printf("  \"hashes\": [\n");
+    for (size_t k = 0; k < nhashers; ++k) {
+        const Hasher* h = &hashers[k];
+        /* fold the hashes into a sink so that the loop cannot be elided */
+        volatile uint64_t sink = 0;
+        uint64_t acc = 0;
+        uint64_t start = now_ns();
+        for (size_t r = 0; r < rounds; ++r) {
+            for (size_t i = 0; i < corpus.size; ++i) {
+                acc += h->hash(corpus.keys[i], corpus.lengths[i]);
+            }
+        }
+        uint64_t elapsed = now_ns() - start;
+        sink = acc;
+        (void) sink;
+        double occupancy, chi2;
+        size_t max_load;
+        distribution(&corpus, h, &occupancy, &chi2, &max_load);
+        printf("    { \"name\": \"%s\", \"ns_per_key\": %.2f, \"mib_per_s\": %.1f, "
+               "\"occupancy\": %.4f, \"chi2\": %.4f, \"max_load\": %zu }%s\n",
+               h->name, (double) elapsed / (rounds * corpus.size),
+               elapsed ? (double) rounds * corpus.bytes / (1 << 20) / (elapsed * 1e-9) : 0.0,
+               occupancy, chi2, max_load, k + 1 < nhashers ? "," : "");
+    }
+    printf("  ]\n");
+    printf("}\n");
+
+    for (size_t i = 0; i < corpus.size; ++i) {
+        free(corpus.keys[i]);
+    }
+    free(corpus.keys);
+    free(corpus.lengths);
+    return 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * btree.h
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * A persistent sorted map from values to values, built as a B+-tree with
+ * wide nodes. Keys are ordered by value_compare(). Entries live in the
+ * leaves only, inner nodes hold the least key of each child, so that a
+ * lookup binary searches one node of up to BTREE_ORDER keys per level.
+ *
+ * Maps are immutable: btree_assoc() and btree_dissoc() copy the nodes on
+ * the path to the changed entry and share all others with the old map.
+ * Iterators visit the entries in order and may start and stop at given
+ * keys, which makes range scans cost O(log n) plus the entries visited.
+ */
+
+#ifndef __BTREE_H__
+#define __BTREE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BTREE_ORDER 32            // most entries or children per node
+#define BTREE_MIN (BTREE_ORDER / 2)
+#define BTREE_MAX_DEPTH 16        // BTREE_MIN^15 entries exceed any address space
+
+struct Value;
+struct BTreeNode;
+
+typedef struct BTree {
+    size_t size;
+    int height;               // number of inner levels above the leaves
+    struct BTreeNode* root;
+} BTree;
+
+typedef struct BTreeIter {
+    int depth;
+    int height;
+    struct BTreeNode* nodes[BTREE_MAX_DEPTH];
+    unsigned pos[BTREE_MAX_DEPTH];
+    struct Value* hi;         // first key not to visit, or NULL
+} BTreeIter;
+
+BTree* btree_new();
+BTree* btree_from_sorted(struct Value** keys, struct Value** values, size_t n);
+struct Value* btree_get(const BTree* tree, struct Value* key);
+BTree* btree_assoc(const BTree* tree, struct Value* key, struct Value* value);
+BTree* btree_dissoc(const BTree* tree, struct Value* key);
+BTree* btree_slice(const BTree* tree, struct Value* lo, struct Value* hi);
+size_t btree_size(const BTree* tree);
+int btree_compare(const BTree* a, const BTree* b);
+uint64_t btree_hash(const BTree* tree);
+
+void btree_iter_init(BTreeIter* it, const BTree* tree, struct Value* lo, struct Value* hi);
+bool btree_iter_next(BTreeIter* it, struct Value** key, struct Value** value);
+
+#endif /* !__BTREE_H__ */
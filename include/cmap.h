@@ -0,0 +1,81 @@
+/*
+ * cmap.h
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * A hashtable for symbol keys that can be shared between threads, e.g. for
+ * the global environment of a multi-threaded interpreter.
+ *
+ * Lookups take no locks and write nothing, so readers never wait for each
+ * other nor for writers. Slots hold pointers to immutable entries and are
+ * probed linearly: a put publishes a complete entry with a single atomic
+ * store, a remove replaces it with a tombstone.
+ *
+ * Writers lock one of CMAP_STRIPES mutexes, chosen by the key's hash, so
+ * that writes to different keys mostly proceed in parallel. Growing takes
+ * all stripes, builds a new slot array next to the old one and publishes
+ * it atomically. Readers keep using whichever array they started with.
+ *
+ * Replaced entries and slot arrays may still be read by lookups in flight,
+ * so they are retired instead of freed. cmap_reclaim() frees them and may
+ * only be called while no other thread uses the map. Memory comes from
+ * malloc(), since the collector is not thread-safe; for the same reason
+ * keys must be interned before they are shared with other threads.
+ *
+ * The collector does not scan malloc'd memory, so values, which must come
+ * from the collector, are made roots while the map holds them and are
+ * unrooted when they are replaced or removed. Writers take a lock for
+ * that, but no other thread may allocate or collect while one writes.
+ */
+
+#ifndef __CMAP_H__
+#define __CMAP_H__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "symbol.h"
+
+#define CMAP_STRIPES 64
+#define CMAP_MIN_CAPACITY 16
+
+typedef struct CMapItem {
+    Symbol* key;
+    void* value;              // the value, which the map neither copies nor frees
+    struct CMapItem* retired; // next retired entry
+} CMapItem;
+
+typedef struct CMapTable {
+    size_t capacity;          // a power of 2
+    struct CMapTable* retired;
+    _Atomic(CMapItem*) slots[];
+} CMapTable;
+
+/* A lock per cache line, so that stripes do not share lines */
+typedef union CMapStripe {
+    pthread_mutex_t lock;
+    char pad[64];
+} CMapStripe;
+
+typedef struct CMap {
+    _Atomic(CMapTable*) table;
+    atomic_size_t size;       // number of entries
+    atomic_size_t used;       // slots holding an entry or a tombstone
+    CMapStripe stripes[CMAP_STRIPES];
+    pthread_mutex_t gc_lock;  // serializes rooting and unrooting values
+    _Atomic(CMapItem*) retired_items;
+    CMapTable* retired_tables;
+} CMap;
+
+CMap* cmap_new(size_t n);
+void cmap_delete(CMap* m);
+
+void* cmap_get(CMap* m, Symbol* key);
+void cmap_put(CMap* m, Symbol* key, void* value);
+void cmap_remove(CMap* m, Symbol* key);
+size_t cmap_size(CMap* m);
+void cmap_reclaim(CMap* m);
+
+#endif /* !__CMAP_H__ */
@@ -12,5 +12,15 @@
 #include "env.h"
 
 Value* core_sum(Value* args);
+Value* core_hash_map(Value* args);
+Value* core_sorted_map(Value* args);
+Value* core_assoc(Value* args);
+Value* core_dissoc(Value* args);
+Value* core_get(Value* args);
+Value* core_submap(Value* args);
+Value* core_count(Value* args);
+Value* core_subs(Value* args);
+
+Environment* core_env_new();
 
 #endif /* !CORE_H */
@@ -7,6 +7,9 @@
 #ifndef __DJB2_H__
 #define __DJB2_H__
 
+#include <stddef.h>
+
 unsigned long djb2(char *str);
+unsigned long djb2_len(const char *str, size_t len);
 
 #endif /* !__DJB2_H__ */
@@ -8,20 +8,83 @@
 #ifndef __ENV_H__
 #define __ENV_H__
 
+#include <stdint.h>
 #include <stdlib.h>
+#include "hamt.h"
 #include "map.h"
 
+#define ENV_BATCH 16          // symbols env_get_many() resolves in one go
+
 struct Value;
 
+/*
+ * An environment either maps symbols to values, or is a frame of a let or
+ * a lambda call. A frame has no map, only a fixed number of slots that
+ * ir_resolve() has assigned to its variables ahead of time.
+ *
+ * The first env_snapshot() of an environment copies its map into a
+ * persistent hash map of bindings and hands that out as it is, so a
+ * snapshot is a consistent view that later definitions do not change.
+ * From then on, definitions update both, at the cost of a few path copied
+ * nodes each. Environments that are never snapshotted have no bindings
+ * and pay nothing. A snapshot has no map of its own, definitions in a
+ * snapshot path copy its bindings in turn.
+ *
+ * Snapshots do not support concurrent eval() yet. Lookups in a snapshot
+ * only read, but eval() also caches cells in the shared IR, reads and
+ * bumps env_version and allocates from the global collector, none of
+ * which is synchronized. Threads must not evaluate at the same time, even
+ * against different snapshots.
+ */
 typedef struct Environment {
-    Map* kv;
+    Map* kv;                  // NULL for frames and snapshots
+    Hamt* bindings;           // NULL for frames and until the first snapshot
     struct Environment* parent;
+    size_t nslots;
+    struct Value** slots;     // the slots of a frame, stored behind it
 } Environment;
 
+/*
+ * Each binding of a symbol lives in a cell that keeps its address until the
+ * binding's environment is deleted. Redefinitions point the cell at the new
+ * value. The version changes whenever a binding is added, a snapshot
+ * redefines one or an environment is deleted, which is when a cell found
+ * earlier may no longer be the right one.
+ */
+extern uint64_t env_version;
+
 Environment* env_new(Environment* parent);
+Environment* env_new_frame(Environment* parent, size_t nslots);
+Environment* env_new_frozen(Symbol** symbols, struct Value** values, size_t n,
+                            const uint32_t* seeds, size_t nseeds);
+Environment* env_snapshot(Environment* env);
 void env_delete(Environment* env);
 
-void env_set(Environment* env, char* symbol, struct Value* value);
-struct Value* env_get(Environment* env, char* symbol);
+void env_set(Environment* env, Symbol* symbol, struct Value* value);
+struct Value* env_get(Environment* env, Symbol* symbol);
+struct Value** env_get_cell(Environment* env, Symbol* symbol);
+size_t env_get_many(Environment* env, Symbol** symbols, struct Value** values, size_t n);
+size_t env_get_cells(Environment* env, Symbol** symbols, struct Value*** cells, size_t n);
+
+/*
+ * The closest environment that holds names. Frames only hold slots, so a
+ * symbol resolves the same way from a frame and from its scope.
+ */
+static inline Environment* env_scope(Environment* env)
+{
+    while (env && !env->kv && !env->bindings) {
+        env = env->parent;
+    }
+    return env;
+}
+
+/* The value in a slot of the frame depth levels up */
+static inline struct Value* env_get_local(Environment* env, unsigned depth, unsigned slot)
+{
+    while (depth--) {
+        env = env->parent;
+    }
+    return env->slots[slot];
+}
 
 #endif /* !__ENV_H__ */
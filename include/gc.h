@@ -13,14 +13,30 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 struct AllocationMap;
+struct Heap;
+struct GcProfile;
+struct GcTrace;
+
+typedef struct GcStats {
+    size_t runs;              // number of collections
+    size_t collected;         // bytes reclaimed over all collections
+    uint64_t last_pause_ns;   // duration of the most recent collection
+    uint64_t total_pause_ns;  // time spent collecting over all collections
+} GcStats;
 
 typedef struct GarbageCollector {
     struct AllocationMap* allocs; // allocation map
     bool paused;                  // (temporarily) switch gc on/off
     void *bos;                    // bottom of stack
     size_t min_size;
+    struct Heap* heap;            // object memory, NULL for the system allocator
+    struct GcProfile* profile;    // sampling heap profiler, NULL if off
+    struct GcTrace* trace;        // allocation trace recorder, NULL if off
+    GcStats stats;                // collection counters and pause times
+    void (*on_run)(struct GarbageCollector*); // called after each collection
 } GarbageCollector;
 
 extern GarbageCollector gc;  // Global garbage collector for all
@@ -31,11 +47,14 @@ extern GarbageCollector gc;  // Global garbage collector for all
  */
 void gc_start(GarbageCollector* gc, void* bos);
 void gc_start_ext(GarbageCollector* gc, void* bos, size_t initial_size, size_t min_size,
-                  double downsize_load_factor, double upsize_load_factor, double sweep_factor);
+                  double downsize_load_factor, double upsize_load_factor, double sweep_factor,
+                  struct Heap* heap);
 void gc_stop(GarbageCollector* gc);
 void gc_pause(GarbageCollector* gc);
 void gc_resume(GarbageCollector* gc);
 size_t gc_run(GarbageCollector* gc);
+void* gc_make_root(GarbageCollector* gc, void* ptr);
+void gc_unroot(GarbageCollector* gc, void* ptr);
 
 /*
  * Allocating and deallocating memory.
@@ -47,6 +66,58 @@ void* gc_calloc_ext(GarbageCollector* gc, size_t count, size_t size, void (*dtor
 void* gc_realloc(GarbageCollector* gc, void* ptr, size_t size);
 void gc_free(GarbageCollector* gc, void* ptr);
 
+/*
+ * Sampling heap profiler.
+ *
+ * Once started, the profiler records the call stack of one allocation every
+ * `sample_interval` bytes. Each sample stands for `sample_interval` bytes (or
+ * its own size if it is larger). Sampled allocations are followed through
+ * collections so that live bytes and survivals can be reported per site.
+ * Dumps are written in folded-stack format ("outer;...;inner value"), which
+ * flamegraph.pl, speedscope and pprof can read.
+ */
+typedef enum {
+    GC_PROFILE_ALLOC_BYTES,   // bytes allocated since the profiler started
+    GC_PROFILE_LIVE_BYTES,    // bytes still allocated
+    GC_PROFILE_SURVIVALS      // number of times sampled objects survived a sweep
+} GcProfileMetric;
+
+void gc_profile_start(GarbageCollector* gc, size_t sample_interval);
+void gc_profile_stop(GarbageCollector* gc);
+size_t gc_profile_dump(GarbageCollector* gc, FILE* out, GcProfileMetric metric);
+
+/*
+ * Allocation tracing.
+ *
+ * A trace is a compact binary log of allocator and collector events that
+ * can be replayed against any collector configuration (see bench/gc_replay.c).
+ * Every traced allocation gets the next sequential id, and events refer to
+ * earlier allocations by their distance `delta` from the last id handed out.
+ * All integers are unsigned LEB128 varints.
+ *
+ *   header   GC_TRACE_MAGIC
+ *   MALLOC   size          allocate id = last + 1
+ *   CALLOC   count size    allocate id = last + 1
+ *   REALLOC  delta size    move (last + 1 - delta) to id = last + 1;
+ *                          delta == 0 reallocates NULL
+ *   FREE     delta         gc_free() of id = last - delta
+ *   SWEEP    delta         collection of id = last - delta
+ *   RUN                    start of a collection
+ */
+#define GC_TRACE_MAGIC "STGCTRC1"
+
+typedef enum {
+    GC_TRACE_MALLOC = 1,
+    GC_TRACE_CALLOC,
+    GC_TRACE_REALLOC,
+    GC_TRACE_FREE,
+    GC_TRACE_SWEEP,
+    GC_TRACE_RUN
+} GcTraceEvent;
+
+bool gc_trace_start(GarbageCollector* gc, FILE* out);
+void gc_trace_stop(GarbageCollector* gc);
+
 /*
  * Helper functions and stdlib replacements.
  */
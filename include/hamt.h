@@ -0,0 +1,54 @@
+/*
+ * hamt.h
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * A persistent hash map from values to values, built as a hash array mapped
+ * trie. Maps are immutable: hamt_assoc() and hamt_dissoc() return a new map
+ * that shares all untouched nodes with the old one, at a cost of
+ * O(log32 n) new nodes.
+ *
+ * Nodes use the compressed (CHAMP) layout: entries and sub-nodes are kept
+ * apart and a sub-node never holds a single entry alone. Every set of
+ * entries therefore has exactly one shape, which lets hamt_equal() compare
+ * maps node by node and skip nodes that two maps share.
+ */
+
+#ifndef __HAMT_H__
+#define __HAMT_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define HAMT_BITS 5
+#define HAMT_MAX_DEPTH (64 / HAMT_BITS + 2)  // trie levels plus a collision node
+
+struct Value;
+struct HamtNode;
+
+typedef struct Hamt {
+    size_t size;
+    struct HamtNode* root;
+} Hamt;
+
+typedef struct HamtIter {
+    int depth;
+    struct HamtNode* nodes[HAMT_MAX_DEPTH];
+    unsigned pos[HAMT_MAX_DEPTH];
+} HamtIter;
+
+Hamt* hamt_new();
+struct Value* hamt_get(const Hamt* hamt, struct Value* key);
+struct Value** hamt_get_cell(const Hamt* hamt, struct Value* key);
+Hamt* hamt_assoc(const Hamt* hamt, struct Value* key, struct Value* value);
+Hamt* hamt_dissoc(const Hamt* hamt, struct Value* key);
+size_t hamt_size(const Hamt* hamt);
+bool hamt_equal(const Hamt* a, const Hamt* b);
+uint64_t hamt_hash(const Hamt* hamt);
+
+void hamt_iter_init(HamtIter* it, const Hamt* hamt);
+bool hamt_iter_next(HamtIter* it, struct Value** key, struct Value** value);
+
+#endif /* !__HAMT_H__ */
@@ -0,0 +1,30 @@
+/*
+ * hash.h
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * The string hash behind symbols and therefore behind every Map and
+ * environment lookup. hash_bytes() is a seeded, word-at-a-time hash after
+ * wyhash: it consumes 8 bytes per step and folds them with a 64x64->128 bit
+ * multiply, so that all bits of the result depend on all input bits.
+ *
+ * hash_string() is the hash the interpreter uses. It is hash_bytes() with
+ * HASH_SEED, or djb2 followed by a multiplicative mix when compiled with
+ * -DHASH_DJB2.
+ */
+
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef HASH_SEED
+#define HASH_SEED 0x243f6a8885a308d3ULL
+#endif
+
+uint64_t hash_bytes(const void* data, size_t len, uint64_t seed);
+uint64_t hash_string(const char* str, size_t len);
+
+#endif /* !__HASH_H__ */
@@ -0,0 +1,68 @@
+/*
+ * heap.h
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * A single reserved range of virtual memory that the garbage collector
+ * carves its objects from, instead of scattering them across whatever
+ * pages malloc() hands out. The range can be backed by transparent huge
+ * pages and bound to a NUMA node, which keeps the TLB footprint of a
+ * mark phase small and its memory accesses node-local.
+ *
+ * Small and medium objects come from segregated free lists per size class,
+ * large objects from an address-ordered, coalescing list of free spans.
+ * Untouched memory is handed out by bumping a pointer, so all objects
+ * live in [base, top).
+ *
+ * A heap can also be laid over a block the caller already owns, see
+ * heap_new_static(). Such a fixed heap never maps or frees memory and the
+ * collector keeps its own metadata in it, so that its footprint is exactly
+ * the size of the block. The block must leave room for the collector's
+ * initial allocation map (a pointer per slot of initial capacity).
+ */
+
+#ifndef __HEAP_H__
+#define __HEAP_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define HEAP_ALIGN 16                       // alignment of every object
+#define HEAP_SMALL_MAX 256                  // small classes step by HEAP_ALIGN
+#define HEAP_MEDIUM_MAX 32768               // medium classes step by powers of 2
+#define HEAP_PAGE 4096                      // large objects round up to pages
+#define HEAP_HUGE_PAGE (2 * 1024 * 1024)
+#define HEAP_CLASSES (HEAP_SMALL_MAX / HEAP_ALIGN + 7)
+
+typedef enum {
+    HEAP_HUGE_PAGES = 0x1,    // back the range with transparent huge pages
+    HEAP_NUMA_BIND = 0x2,     // allocate the range on a single NUMA node
+    HEAP_FIXED = 0x4          // the range is a caller-owned block
+} HeapFlags;
+
+struct HeapChunk;
+struct HeapSpan;
+
+typedef struct Heap {
+    char* base;               // start of the reserved range
+    char* top;                // bump pointer, [top, limit) is untouched
+    char* limit;              // end of the reserved range
+    size_t used;              // bytes currently handed out
+    struct HeapChunk* free[HEAP_CLASSES];  // free lists per size class
+    struct HeapSpan* spans;   // free large blocks, ordered by address
+    int flags;                // HeapFlags the heap was created with
+} Heap;
+
+Heap* heap_new(size_t size, int flags, int numa_node);
+Heap* heap_new_static(void* block, size_t size);
+void heap_delete(Heap* heap);
+
+void* heap_alloc(Heap* heap, size_t size);
+void* heap_realloc(Heap* heap, void* ptr, size_t old_size, size_t size);
+void heap_free(Heap* heap, void* ptr, size_t size);
+
+size_t heap_chunk_size(size_t size);
+#define heap_contains(h, p) ((char*) (p) >= (h)->base && (char*) (p) < (h)->top)
+
+#endif /* !__HEAP_H__ */
@@ -15,5 +15,6 @@ Value* ir_from_ast(AstSexpr* ast);
 Value* ir_from_ast_atom(AstAtom*);
 Value* ir_from_ast_list(AstList*);
 Value* ir_from_ast_sexpr(AstSexpr*);
+Value* ir_resolve(Value* expr);
 
 #endif /* !IR_H */
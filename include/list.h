@@ -10,6 +10,11 @@
 
 #include <stddef.h>
 
+/*
+ * A doubly-linked list of pointers. The list refers to its elements and
+ * neither copies nor frees them.
+ */
+
 struct ListItem;
 
 typedef struct List {
@@ -22,8 +27,8 @@ List* list_new();
 void list_delete(List* l);
 void* list_head(List* l);
 List* list_tail(List* l);
-void list_append(List* l, void* value, size_t size);
-void list_prepend(List* l, void* value, size_t size);
+void list_append(List* l, void* value);
+void list_prepend(List* l, void* value);
 size_t list_size(List* l);
 
 #endif /* !__LIST_H__ */
@@ -5,7 +5,32 @@
  *
  * Distributed under terms of the MIT license.
  *
- * A simple hashtable implementation for string keys, using separate chaining.
+ * A hashtable implementation for symbol keys, using open addressing in the
+ * style of Swiss tables. The slots are a MapSlots table generated from the
+ * template in table.h, specialized for interned symbols.
+ *
+ * Keys are interned symbols, so they carry their hash and compare by pointer.
+ * Every entry is a single allocation that holds the key and a pointer to
+ * the value. Entries never move and an update only replaces the pointer, so
+ * map_get_cell() hands out the address of a value that stays valid until
+ * its key is removed.
+ *
+ * Growing or shrinking the table is incremental. The old slots stay around
+ * next to the new ones and every put or remove moves MAP_MIGRATE_SLOTS of
+ * them over, so that no single operation rehashes the whole table. Lookups
+ * check both sets of slots while a resize is in progress.
+ *
+ * Maps of up to MAP_SMALL_SIZE entries, like most environments, have no
+ * slots at all. Their keys and entries sit in two short arrays inside the
+ * Map itself and lookups scan the keys. The first put beyond that switches
+ * the map to slots for good.
+ *
+ * A map whose keys no longer change can be frozen with map_freeze(). A
+ * frozen map keeps its entries in a minimal perfect hash table (see mph.h)
+ * of exactly size slots, so a lookup takes a single probe and never meets
+ * another key. map_new_frozen() builds a frozen map from a table computed
+ * ahead of time. Putting into or removing from a frozen map thaws it
+ * again.
  */
 
 #ifndef __HT_H__
@@ -13,30 +38,53 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+
+#include "symbol.h"
+
+#define MAP_GROUP_SIZE TABLE_GROUP_SIZE
+#define MAP_MIGRATE_SLOTS (2 * MAP_GROUP_SIZE)
+#define MAP_SMALL_SIZE 8
 
 typedef struct MapItem {
-    char* key;
-    void* value;
-    size_t size;
-    struct MapItem* next;
+    Symbol* key;
+    void* value;              // the value, which the map neither copies nor frees
 } MapItem;
 
+#define TABLE_TYPE MapSlots
+#define TABLE_PREFIX map_slots
+#define TABLE_KEY Symbol*
+#define TABLE_ENTRY MapItem*
+#define TABLE_ENTRY_KEY(e) ((e)->key)
+#define TABLE_HASH(k) ((k)->hash)
+#define TABLE_EQUAL(a, b) ((a) == (b))
+#include "table.h"
+
 typedef struct Map {
-    size_t capacity;
-    size_t size;
-    MapItem** items;
+    size_t size;              // number of entries
+    MapSlots slots;           // capacity 0 if small or frozen
+    MapSlots old;             // slots being migrated away from, ctrl NULL if none
+    size_t migrated;          // old slots before this one have been moved
+    Symbol* small_keys[MAP_SMALL_SIZE];     // keys of a small map, in order of insertion
+    MapItem* small_items[MAP_SMALL_SIZE];   // entries of a small map
+    MapItem** frozen;         // the slots of a frozen map, or NULL
+    uint32_t* seeds;          // bucket seeds of a frozen map, stored behind its slots
+    size_t nseeds;
 } Map;
 
 Map* map_new(size_t n);
 void map_delete(Map*);
 
-void* map_get(Map* ht, char* key);
-void map_put(Map* ht, char* key, void* value, size_t siz);
-void map_remove(Map* ht, char* key);
+void* map_get(Map* ht, Symbol* key);
+void** map_get_cell(Map* ht, Symbol* key);
+size_t map_get_many(Map* ht, Symbol** keys, void** values, size_t n);
+size_t map_get_cells(Map* ht, Symbol** keys, void*** cells, size_t n);
+void map_put(Map* ht, Symbol* key, void* value);
+void map_remove(Map* ht, Symbol* key);
+void map_items(Map* ht, MapItem** items);
 void map_resize(Map* ht, size_t capacity);
-
-// helpers
-
-bool is_prime(size_t n);
+void map_freeze(Map* ht);
+Map* map_new_frozen(Symbol** keys, void** values, size_t n,
+                    const uint32_t* seeds, size_t nseeds);
 
 #endif /* !__HT_H__ */
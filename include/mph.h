@@ -0,0 +1,43 @@
+/*
+ * mph.h
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * Minimal perfect hashing of a fixed set of n 64-bit hashes onto the slots
+ * 0..n-1, by hash and displace: the keys are split into buckets by the high
+ * half of their hash and every bucket gets a seed, chosen so that its keys
+ * land on slots no other key uses. A lookup costs one seed load and one
+ * probe, and the table holds exactly n slots.
+ *
+ * The hashes must be distinct. The functions here depend on nothing but the
+ * hashes, so that a table can be computed at build time and used at run
+ * time, see tools/mph_gen.c.
+ */
+
+#ifndef __MPH_H__
+#define __MPH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MPH_BUCKET_SIZE 4     // keys per bucket on average
+#define MPH_MAX_SEED (1u << 20)
+
+/* Number of buckets for n keys */
+#define mph_buckets(n) ((n) / MPH_BUCKET_SIZE + 1)
+
+static inline size_t mph_bucket(uint64_t hash, size_t nbuckets)
+{
+    return (size_t) (((hash >> 32) * (uint64_t) nbuckets) >> 32);
+}
+
+static inline size_t mph_slot(uint64_t hash, uint32_t seed, size_t n)
+{
+    uint64_t h = (hash ^ (seed * 0xbf58476d1ce4e5b9ULL)) * 0x94d049bb133111ebULL;
+    return (size_t) (((h >> 32) * (uint64_t) n) >> 32);
+}
+
+int mph_build(const uint64_t* hashes, size_t n, uint32_t* seeds, size_t nbuckets);
+
+#endif /* !__MPH_H__ */
@@ -0,0 +1,39 @@
+/*
+ * str.h
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * Immutable strings that know their length and hash. A string either owns
+ * its characters, which follow the header in the same allocation and are
+ * NUL-terminated, or is a slice of another string and points into that
+ * string's buffer. Slicing therefore neither copies nor allocates more than
+ * a header, whatever the length of the slice.
+ *
+ * Slices are not NUL-terminated, so characters must be read together with
+ * the length. The hash of a slice is computed on first use and kept.
+ */
+
+#ifndef __STR_H__
+#define __STR_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct String {
+    size_t length;
+    uint64_t hash;            // hash_string() of the characters, if hashed
+    bool hashed;
+    const char* chars;
+    struct String* base;      // the string that owns the characters of a slice, or NULL
+    char buf[];               // the characters of a string that is not a slice
+} String;
+
+String* string_new(const char* chars, size_t length);
+String* string_slice(String* s, size_t start, size_t end);
+uint64_t string_hash(String* s);
+bool string_equal(String* a, String* b);
+int string_compare(const String* a, const String* b);
+
+#endif /* !__STR_H__ */
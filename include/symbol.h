@@ -0,0 +1,32 @@
+/*
+ * symbol.h
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * Interned symbols. Every symbol name maps to exactly one Symbol object, which
+ * carries the hash of its name. Symbols can therefore be compared by pointer
+ * and hashed without looking at their names again. Interned symbols live in
+ * the global collector and are never freed, and so does the one value each
+ * symbol hands out for use as a map key, see value_symbol().
+ */
+
+#ifndef __SYMBOL_H__
+#define __SYMBOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct Value;
+
+typedef struct Symbol {
+    uint64_t hash;            // hash of the name
+    size_t length;            // length of the name
+    struct Value* value;      // the shared symbol value, made on first use
+    char name[];
+} Symbol;
+
+Symbol* symbol_intern(char* name);
+uint64_t symbol_hash(char* name);
+
+#endif /* !__SYMBOL_H__ */
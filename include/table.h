@@ -0,0 +1,232 @@
+/*
+ * table.h
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * A template for hash tables in the style of Swiss tables, specialized for
+ * a key and an entry type at compile time. Slots come in groups of
+ * TABLE_GROUP_SIZE and each slot has a control byte that marks it as empty,
+ * deleted or holds the low 7 bits of its key's hash. A lookup matches the
+ * control bytes of a whole group at once and only compares the keys of
+ * slots whose hash bits agree.
+ *
+ * Define the following and include this file to generate a table type and
+ * static inline functions prefixed with TABLE_PREFIX:
+ *
+ *     TABLE_TYPE          name of the table type
+ *     TABLE_PREFIX        prefix of the generated functions
+ *     TABLE_KEY           key type
+ *     TABLE_ENTRY         type stored in the slots, usually a pointer
+ *     TABLE_ENTRY_KEY(e)  key of entry e
+ *     TABLE_HASH(k)       64-bit hash of key k, all bits well mixed
+ *     TABLE_EQUAL(a, b)   whether keys a and b are equal
+ *
+ * Hashing and comparing are inlined into every specialization. The table
+ * neither allocates nor frees: its user hands a block of
+ * PREFIX_bytes(capacity) bytes to PREFIX_init() and decides when to grow,
+ * so that each table keeps its own memory and resize policy.
+ */
+
+#ifndef __TABLE_H__
+#define __TABLE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define TABLE_GROUP_SIZE 16
+
+/*
+ * Control bytes. Full slots hold the low 7 bits of their hash, so that the
+ * sign bit alone tells free from full slots.
+ */
+#define TABLE_EMPTY ((signed char) -128)
+#define TABLE_DELETED ((signed char) -2)
+#define TABLE_H1(hash) ((hash) >> 7)
+#define TABLE_H2(hash) ((signed char) ((hash) & 0x7f))
+
+#ifdef __GNUC__
+#define TABLE_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define TABLE_PREFETCH(p) ((void) (p))
+#endif
+
+/* Bit i is set if slot i of a group matches */
+typedef uint32_t TableMask;
+
+static inline TableMask table_group_match(const signed char* group, signed char h2)
+{
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i*) group);
+    return (TableMask) _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(h2)));
+#else
+    TableMask mask = 0;
+    for (int i = 0; i < TABLE_GROUP_SIZE; ++i) {
+        mask |= (TableMask) (group[i] == h2) << i;
+    }
+    return mask;
+#endif
+}
+
+static inline TableMask table_group_match_free(const signed char* group)
+{
+#ifdef __SSE2__
+    return (TableMask) _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) group));
+#else
+    TableMask mask = 0;
+    for (int i = 0; i < TABLE_GROUP_SIZE; ++i) {
+        mask |= (TableMask) (group[i] < 0) << i;
+    }
+    return mask;
+#endif
+}
+
+/* Smallest capacity that holds n entries at a load factor of at most 7/8 */
+static inline size_t table_capacity_for(size_t n)
+{
+    size_t capacity = TABLE_GROUP_SIZE;
+    while (capacity - capacity / 8 < n) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+#define TABLE_CONCAT_(a, b) a ## _ ## b
+#define TABLE_CONCAT(a, b) TABLE_CONCAT_(a, b)
+
+#endif /* !__TABLE_H__ */
+
+#if !defined(TABLE_TYPE) || !defined(TABLE_PREFIX) || !defined(TABLE_KEY) \
+    || !defined(TABLE_ENTRY) || !defined(TABLE_ENTRY_KEY) || !defined(TABLE_HASH) \
+    || !defined(TABLE_EQUAL)
+#error "table.h needs TABLE_TYPE, TABLE_PREFIX, TABLE_KEY, TABLE_ENTRY, TABLE_ENTRY_KEY, TABLE_HASH and TABLE_EQUAL"
+#endif
+
+#define TABLE_FN(name) TABLE_CONCAT(TABLE_PREFIX, name)
+
+typedef struct TABLE_TYPE {
+    size_t capacity;          // number of slots, a power of 2 >= TABLE_GROUP_SIZE, or 0
+    size_t growth_left;       // inserts into empty slots until the table is full
+    signed char* ctrl;        // one control byte per slot
+    TABLE_ENTRY* slots;       // the slots, stored behind the control bytes
+} TABLE_TYPE;
+
+/* Size of the block that holds a table of the given capacity */
+static inline size_t TABLE_FN(bytes)(size_t capacity)
+{
+    return capacity * (1 + sizeof(TABLE_ENTRY));
+}
+
+/* Lays out an empty table over a block of TABLE_FN(bytes)(capacity) bytes */
+static inline void TABLE_FN(init)(TABLE_TYPE* t, void* block, size_t capacity)
+{
+    /* capacity is a multiple of the group size, which keeps the slots aligned */
+    t->ctrl = (signed char*) block;
+    t->slots = (TABLE_ENTRY*) (t->ctrl + capacity);
+    memset(t->ctrl, TABLE_EMPTY, capacity);
+    t->capacity = capacity;
+    t->growth_left = capacity - capacity / 8;
+}
+
+static inline bool TABLE_FN(full)(const TABLE_TYPE* t, size_t slot)
+{
+    return t->ctrl[slot] >= 0;
+}
+
+/*
+ * Probe whole groups in triangular steps, which visits every group of a
+ * power of 2 sized table. The table is never full, so a probe always ends
+ * at a group with an empty slot. Returns the slot of the key, or the
+ * capacity if it is not in the table.
+ */
+static inline size_t TABLE_FN(find)(const TABLE_TYPE* t, TABLE_KEY key)
+{
+    uint64_t hash = TABLE_HASH(key);
+    size_t mask = t->capacity / TABLE_GROUP_SIZE - 1;
+    size_t group = TABLE_H1(hash) & mask;
+    signed char h2 = TABLE_H2(hash);
+    for (size_t step = 1; ; ++step) {
+        const signed char* g = t->ctrl + group * TABLE_GROUP_SIZE;
+        for (TableMask m = table_group_match(g, h2); m; m &= m - 1) {
+            size_t slot = group * TABLE_GROUP_SIZE + __builtin_ctz(m);
+            if (TABLE_EQUAL(TABLE_ENTRY_KEY(t->slots[slot]), key)) {
+                return slot;
+            }
+        }
+        if (table_group_match(g, TABLE_EMPTY)) {
+            return t->capacity;
+        }
+        group = (group + step) & mask;
+    }
+}
+
+/* First empty or deleted slot on the probe sequence of a hash */
+static inline size_t TABLE_FN(find_free)(const TABLE_TYPE* t, uint64_t hash)
+{
+    size_t mask = t->capacity / TABLE_GROUP_SIZE - 1;
+    size_t group = TABLE_H1(hash) & mask;
+    for (size_t step = 1; ; ++step) {
+        TableMask m = table_group_match_free(t->ctrl + group * TABLE_GROUP_SIZE);
+        if (m) {
+            return group * TABLE_GROUP_SIZE + __builtin_ctz(m);
+        }
+        group = (group + step) & mask;
+    }
+}
+
+/* Whether placing an entry into the slot would use up the last empty slot */
+static inline bool TABLE_FN(exhausts)(const TABLE_TYPE* t, size_t slot)
+{
+    return t->ctrl[slot] == TABLE_EMPTY && t->growth_left == 0;
+}
+
+static inline void TABLE_FN(place_at)(TABLE_TYPE* t, size_t slot, TABLE_ENTRY entry)
+{
+    if (t->ctrl[slot] == TABLE_EMPTY) {
+        t->growth_left--;
+    }
+    t->ctrl[slot] = TABLE_H2(TABLE_HASH(TABLE_ENTRY_KEY(entry)));
+    t->slots[slot] = entry;
+}
+
+/* Places an entry whose key is not in the table yet */
+static inline void TABLE_FN(place)(TABLE_TYPE* t, TABLE_ENTRY entry)
+{
+    TABLE_FN(place_at)(t, TABLE_FN(find_free)(t, TABLE_HASH(TABLE_ENTRY_KEY(entry))), entry);
+}
+
+static inline void TABLE_FN(erase)(TABLE_TYPE* t, size_t slot)
+{
+    /* A probe only continues past a group without empty slots. If this
+     * group still has one, no probe depends on the slot and it can become
+     * empty. */
+    const signed char* group = t->ctrl + slot / TABLE_GROUP_SIZE * TABLE_GROUP_SIZE;
+    if (table_group_match(group, TABLE_EMPTY)) {
+        t->ctrl[slot] = TABLE_EMPTY;
+        t->growth_left++;
+    } else {
+        t->ctrl[slot] = TABLE_DELETED;
+    }
+}
+
+/* Pulls the first group a key probes into the cache */
+static inline void TABLE_FN(prefetch)(const TABLE_TYPE* t, TABLE_KEY key)
+{
+    size_t group = TABLE_H1(TABLE_HASH(key)) & (t->capacity / TABLE_GROUP_SIZE - 1);
+    TABLE_PREFETCH(t->ctrl + group * TABLE_GROUP_SIZE);
+    TABLE_PREFETCH(t->slots + group * TABLE_GROUP_SIZE);
+}
+
+#undef TABLE_FN
+#undef TABLE_TYPE
+#undef TABLE_PREFIX
+#undef TABLE_KEY
+#undef TABLE_ENTRY
+#undef TABLE_ENTRY_KEY
+#undef TABLE_HASH
+#undef TABLE_EQUAL
@@ -8,30 +8,65 @@
 #ifndef VALUE_H
 #define VALUE_H
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
 #include "array.h"
+#include "btree.h"
 #include "env.h"
+#include "hamt.h"
 #include "map.h"
+#include "str.h"
+#include "symbol.h"
 #include "list.h"
 
 typedef enum {
     VALUE_NIL,
+    VALUE_BOOL,
     VALUE_INT,
     VALUE_FLOAT,
     VALUE_STRING,
     VALUE_SYMBOL,
     VALUE_LIST,
-    VALUE_FN
+    VALUE_FN,
+    VALUE_MAP,
+    VALUE_SORTED_MAP,
+    VALUE_LAMBDA,
+    VALUE_LOCAL,              // a symbol resolved by ir_resolve(), only found in IR
+    VALUE_GLOBAL              // a symbol ir_resolve() left to the environment, ditto
 } ValueType;
 
+/*
+ * Values are handed around as Value pointers, but nil, booleans, ints and
+ * floats never live on the heap. They are encoded in the pointer itself,
+ * only compound values are allocated:
+ *
+ *     0x0000 0000 0000 0002     nil
+ *     0x0000 0000 0000 0006/7   false/true
+ *     0x0000 pppp pppp pppp     a Value on the heap, at address p
+ *     0x0002 ... 0xfffc ...     a double, its bits plus VALUE_DOUBLE_OFFSET
+ *     0xfffe 0000 iiii iiii     a 32-bit int
+ *
+ * Addresses take up at most 48 bits, so offsetting doubles keeps them apart
+ * from pointers, and NaNs are stored as one canonical NaN so that no double
+ * reaches the int tag. Pointers stay as they are, which lets the
+ * conservative collector find heap values without knowing the encoding.
+ *
+ * The type and the contents of a value are read with value_type(),
+ * value_int(), value_float() and value_bool(). Only values of the other
+ * types may be dereferenced.
+ */
 typedef struct Value {
     ValueType type;
     union {
-        int int_;
-        double float_;
-        char* str;
+        String* string;
+        Symbol* symbol;
         Array* vector;
         List* list;
         Map* map;
+        Hamt* hamt;
+        BTree* btree;
 
         struct Value* (*fn)(struct Value*);
 
@@ -40,21 +75,85 @@ typedef struct Value {
             struct Value* body;
             Environment* env;
         } fun;
+
+        struct {
+            unsigned depth;   // frames to go up
+            unsigned slot;    // slot in that frame
+            Symbol* symbol;
+        } local;
+
+        struct {
+            Symbol* symbol;
+            struct Value** cell;      // the cell found at the last lookup, or NULL
+            Environment* env;         // env_scope() of the last lookup
+            uint64_t version;         // env_version at the last lookup
+        } global;
     } value;
 } Value;
 
+#define VALUE_NIL_BITS 0x02ULL
+#define VALUE_FALSE_BITS 0x06ULL
+#define VALUE_TRUE_BITS 0x07ULL
+#define VALUE_DOUBLE_OFFSET (1ULL << 49)
+#define VALUE_INT_TAG 0xfffe000000000000ULL
+#define VALUE_POINTER_MASK 0xffff000000000000ULL
+
+_Static_assert(sizeof(Value*) == sizeof(uint64_t), "values need 64-bit pointers");
+
+static inline uint64_t value_bits(const Value* v)
+{
+    return (uint64_t) (uintptr_t) v;
+}
+
+static inline ValueType value_type(const Value* v)
+{
+    uint64_t bits = value_bits(v);
+    if ((bits & VALUE_INT_TAG) == VALUE_INT_TAG) return VALUE_INT;
+    if (bits & VALUE_POINTER_MASK) return VALUE_FLOAT;
+    if (bits == VALUE_NIL_BITS) return VALUE_NIL;
+    if (bits == VALUE_FALSE_BITS || bits == VALUE_TRUE_BITS) return VALUE_BOOL;
+    return v->type;
+}
+
+static inline int value_int(const Value* v)
+{
+    return (int32_t) (uint32_t) value_bits(v);
+}
+
+static inline double value_float(const Value* v)
+{
+    uint64_t bits = value_bits(v) - VALUE_DOUBLE_OFFSET;
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+static inline bool value_bool(const Value* v)
+{
+    return value_bits(v) == VALUE_TRUE_BITS;
+}
+
 //
 // functions
 //
 Value* value_new_nil();
+Value* value_new_bool(bool b);
 Value* value_new_int(int int_);
 Value* value_new_float(float float_);
 Value* value_new_fn(Value* (fn)(Value*));
 Value* value_new_string(char* str);
+Value* value_new_string_from(String* string);
 Value* value_new_symbol(char* str);
+Value* value_symbol(Symbol* symbol);
 Value* value_new_list();
+Value* value_new_map(Hamt* hamt);
+Value* value_new_sorted_map(BTree* btree);
+Value* value_new_lambda(Value* args, Value* body, Environment* env);
 void value_delete(Value* v);
 void value_print(Value* v);
+bool value_equal(Value* a, Value* b);
+int value_compare(Value* a, Value* b);
+uint64_t value_hash(Value* v);
 
 
 #endif /* !VALUE_H */
@@ -0,0 +1,418 @@
+/*
+ * btree.c
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include <string.h>
+
+#include "btree.h"
+#include "gc.h"
+#include "log.h"
+#include "value.h"
+
+/*
+ * A tree node. Leaves hold their entries in key order. Inner nodes hold
+ * their children in key order, each along with the least key below it.
+ * Every node but the root holds at least BTREE_MIN entries or children.
+ */
+typedef struct BTreeNode {
+    unsigned n;
+    Value* keys[BTREE_ORDER];
+    void* slots[BTREE_ORDER]; // values of a leaf, children of an inner node
+} BTreeNode;
+
+static BTreeNode* btree_node_new(Value** keys, void** slots, unsigned n)
+{
+    BTreeNode* node = gc_malloc(&gc, sizeof(BTreeNode));
+    node->n = n;
+    memcpy(node->keys, keys, n * sizeof(Value*));
+    memcpy(node->slots, slots, n * sizeof(void*));
+    return node;
+}
+
+static BTreeNode* btree_node_copy(const BTreeNode* node)
+{
+    return btree_node_new((Value**) node->keys, (void**) node->slots, node->n);
+}
+
+/* Number of keys in the node that are not greater than key */
+static unsigned btree_upper(const BTreeNode* node, Value* key)
+{
+    unsigned lo = 0, hi = node->n;
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (value_compare(node->keys[mid], key) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Number of keys in the node that are less than key */
+static unsigned btree_lower(const BTreeNode* node, Value* key)
+{
+    unsigned lo = 0, hi = node->n;
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (value_compare(node->keys[mid], key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* The child of an inner node that would hold key */
+static unsigned btree_child(const BTreeNode* node, Value* key)
+{
+    unsigned i = btree_upper(node, key);
+    return i ? i - 1 : 0;
+}
+
+/*
+ * Copies the node with an entry inserted at position i. If that overflows
+ * the node, the entries are split in halves and the upper one is returned
+ * in *split.
+ */
+static BTreeNode* btree_node_insert(const BTreeNode* node, unsigned i, Value* key, void* slot,
+                                    BTreeNode** split)
+{
+    Value* keys[BTREE_ORDER + 1];
+    void* slots[BTREE_ORDER + 1];
+    unsigned n = node->n + 1;
+    memcpy(keys, node->keys, i * sizeof(Value*));
+    memcpy(slots, node->slots, i * sizeof(void*));
+    keys[i] = key;
+    slots[i] = slot;
+    memcpy(keys + i + 1, node->keys + i, (node->n - i) * sizeof(Value*));
+    memcpy(slots + i + 1, node->slots + i, (node->n - i) * sizeof(void*));
+    unsigned left = n <= BTREE_ORDER ? n : n / 2;
+    *split = left < n ? btree_node_new(keys + left, slots + left, n - left) : NULL;
+    return btree_node_new(keys, slots, left);
+}
+
+/* Copies the node without the entry at position i */
+static BTreeNode* btree_node_remove(const BTreeNode* node, unsigned i)
+{
+    BTreeNode* copy = btree_node_copy(node);
+    copy->n--;
+    memmove(copy->keys + i, copy->keys + i + 1, (copy->n - i) * sizeof(Value*));
+    memmove(copy->slots + i, copy->slots + i + 1, (copy->n - i) * sizeof(void*));
+    return copy;
+}
+
+static BTreeNode* btree_node_assoc(const BTreeNode* node, int height, Value* key,
+                                   Value* value, BTreeNode** split, bool* added)
+{
+    *split = NULL;
+    if (height == 0) {
+        unsigned i = btree_upper(node, key);
+        if (i > 0 && value_compare(node->keys[i - 1], key) == 0) {
+            if (node->slots[i - 1] == value) {
+                return (BTreeNode*) node;
+            }
+            BTreeNode* copy = btree_node_copy(node);
+            copy->slots[i - 1] = value;
+            return copy;
+        }
+        *added = true;
+        return btree_node_insert(node, i, key, value, split);
+    }
+    unsigned i = btree_child(node, key);
+    BTreeNode* child = node->slots[i];
+    BTreeNode* child_split;
+    BTreeNode* updated = btree_node_assoc(child, height - 1, key, value, &child_split, added);
+    if (updated == child) {
+        return (BTreeNode*) node;
+    }
+    BTreeNode* copy;
+    if (child_split) {
+        copy = btree_node_insert(node, i + 1, child_split->keys[0], child_split, split);
+    } else {
+        copy = btree_node_copy(node);
+    }
+    // a split may have moved the updated child to the upper half
+    BTreeNode* holder = i < copy->n ? copy : *split;
+    unsigned at = i < copy->n ? i : i - copy->n;
+    holder->keys[at] = updated->keys[0];
+    holder->slots[at] = updated;
+    return copy;
+}
+
+static BTreeNode* btree_node_dissoc(const BTreeNode* node, int height, Value* key,
+                                    bool* removed)
+{
+    if (height == 0) {
+        unsigned i = btree_upper(node, key);
+        if (i == 0 || value_compare(node->keys[i - 1], key) != 0) {
+            return (BTreeNode*) node;
+        }
+        *removed = true;
+        return btree_node_remove(node, i - 1);
+    }
+    unsigned i = btree_child(node, key);
+    BTreeNode* child = node->slots[i];
+    BTreeNode* updated = btree_node_dissoc(child, height - 1, key, removed);
+    if (updated == child) {
+        return (BTreeNode*) node;
+    }
+    if (updated->n >= BTREE_MIN || node->n == 1) {
+        BTreeNode* copy = btree_node_copy(node);
+        copy->keys[i] = updated->n ? updated->keys[0] : copy->keys[i];
+        copy->slots[i] = updated;
+        return copy;
+    }
+    /* The child ran short. Merge it with a neighbour, or share the
+     * entries of both evenly if they do not fit into one node. */
+    unsigned l = i + 1 < node->n ? i : i - 1;
+    BTreeNode* left = l == i ? updated : node->slots[l];
+    BTreeNode* right = l == i ? node->slots[l + 1] : updated;
+    Value* keys[2 * BTREE_ORDER];
+    void* slots[2 * BTREE_ORDER];
+    unsigned n = left->n + right->n;
+    memcpy(keys, left->keys, left->n * sizeof(Value*));
+    memcpy(slots, left->slots, left->n * sizeof(void*));
+    memcpy(keys + left->n, right->keys, right->n * sizeof(Value*));
+    memcpy(slots + left->n, right->slots, right->n * sizeof(void*));
+    if (n <= BTREE_ORDER) {
+        BTreeNode* merged = btree_node_new(keys, slots, n);
+        BTreeNode* copy = btree_node_remove(node, l + 1);
+        copy->keys[l] = merged->keys[0];
+        copy->slots[l] = merged;
+        return copy;
+    }
+    BTreeNode* copy = btree_node_copy(node);
+    copy->slots[l] = btree_node_new(keys, slots, n / 2);
+    copy->slots[l + 1] = btree_node_new(keys + n / 2, slots + n / 2, n - n / 2);
+    copy->keys[l] = keys[0];
+    copy->keys[l + 1] = keys[n / 2];
+    return copy;
+}
+
+static BTree* btree_wrap(BTreeNode* root, size_t size, int height)
+{
+    BTree* tree = gc_malloc(&gc, sizeof(BTree));
+    tree->root = root;
+    tree->size = size;
+    tree->height = height;
+    return tree;
+}
+
+BTree* btree_new()
+{
+    return btree_wrap(btree_node_new(NULL, NULL, 0), 0, 0);
+}
+
+/*
+ * Builds a tree bottom up, one level at a time, from keys in ascending
+ * order. Each level packs its entries into as few nodes as possible and
+ * spreads them evenly, so that every node holds at least BTREE_MIN.
+ * Unsorted keys are inserted one at a time instead, later keys win.
+ */
+BTree* btree_from_sorted(Value** keys, Value** values, size_t n)
+{
+    for (size_t i = 1; i < n; ++i) {
+        if (value_compare(keys[i - 1], keys[i]) >= 0) {
+            LOG_DEBUG("Keys not in ascending order at %zu, inserting instead", i);
+            BTree* tree = btree_new();
+            for (size_t j = 0; j < n; ++j) {
+                tree = btree_assoc(tree, keys[j], values[j]);
+            }
+            return tree;
+        }
+    }
+    if (n == 0) {
+        return btree_new();
+    }
+    /* The levels live in the managed heap, so that the collector sees the
+     * nodes built so far */
+    BTreeNode** level = NULL;
+    size_t count = n;
+    int height = 0;
+    for (;;) {
+        size_t nodes = (count + BTREE_ORDER - 1) / BTREE_ORDER;
+        BTreeNode** next = gc_malloc(&gc, nodes * sizeof(BTreeNode*));
+        for (size_t j = 0, k = 0; j < nodes; ++j) {
+            unsigned m = count / nodes + (j < count % nodes);
+            next[j] = btree_node_new(NULL, NULL, 0);
+            for (unsigned e = 0; e < m; ++e, ++k) {
+                next[j]->keys[e] = level ? level[k]->keys[0] : keys[k];
+                next[j]->slots[e] = level ? (void*) level[k] : (void*) values[k];
+            }
+            next[j]->n = m;
+        }
+        if (level) {
+            gc_free(&gc, level);
+        }
+        level = next;
+        count = nodes;
+        if (count == 1) {
+            break;
+        }
+        height++;
+    }
+    BTree* tree = btree_wrap(level[0], n, height);
+    gc_free(&gc, level);
+    return tree;
+}
+
+Value* btree_get(const BTree* tree, Value* key)
+{
+    const BTreeNode* node = tree->root;
+    for (int h = tree->height; h > 0; --h) {
+        node = node->slots[btree_child(node, key)];
+    }
+    unsigned i = btree_upper(node, key);
+    return i && value_compare(node->keys[i - 1], key) == 0 ? node->slots[i - 1] : NULL;
+}
+
+BTree* btree_assoc(const BTree* tree, Value* key, Value* value)
+{
+    bool added = false;
+    BTreeNode* split;
+    BTreeNode* root = btree_node_assoc(tree->root, tree->height, key, value, &split, &added);
+    if (root == tree->root) {
+        return (BTree*) tree;
+    }
+    if (split) {
+        Value* keys[2] = { root->keys[0], split->keys[0] };
+        void* slots[2] = { root, split };
+        return btree_wrap(btree_node_new(keys, slots, 2), tree->size + added, tree->height + 1);
+    }
+    return btree_wrap(root, tree->size + added, tree->height);
+}
+
+BTree* btree_dissoc(const BTree* tree, Value* key)
+{
+    bool removed = false;
+    BTreeNode* root = btree_node_dissoc(tree->root, tree->height, key, &removed);
+    if (root == tree->root) {
+        return (BTree*) tree;
+    }
+    int height = tree->height;
+    if (height > 0 && root->n == 1) {
+        root = root->slots[0];
+        height--;
+    }
+    return btree_wrap(root, tree->size - removed, height);
+}
+
+/* The entries with keys from lo up to but excluding hi, NULL means unbounded */
+BTree* btree_slice(const BTree* tree, Value* lo, Value* hi)
+{
+    BTreeIter it;
+    Value* key;
+    Value* value;
+    size_t n = 0;
+    btree_iter_init(&it, tree, lo, hi);
+    while (btree_iter_next(&it, &key, &value)) {
+        n++;
+    }
+    if (n == tree->size) {
+        return (BTree*) tree;
+    }
+    Value** keys = gc_malloc(&gc, (n ? n : 1) * 2 * sizeof(Value*));
+    Value** values = keys + n;
+    n = 0;
+    btree_iter_init(&it, tree, lo, hi);
+    while (btree_iter_next(&it, &keys[n], &values[n])) {
+        n++;
+    }
+    BTree* slice = btree_from_sorted(keys, values, n);
+    gc_free(&gc, keys);
+    return slice;
+}
+
+size_t btree_size(const BTree* tree)
+{
+    return tree->size;
+}
+
+/* Orders maps by their entries, key before value, like words in a dictionary */
+int btree_compare(const BTree* a, const BTree* b)
+{
+    if (a == b) {
+        return 0;
+    }
+    BTreeIter ia, ib;
+    Value* ka;
+    Value* va;
+    Value* kb;
+    Value* vb;
+    btree_iter_init(&ia, a, NULL, NULL);
+    btree_iter_init(&ib, b, NULL, NULL);
+    for (;;) {
+        bool more_a = btree_iter_next(&ia, &ka, &va);
+        bool more_b = btree_iter_next(&ib, &kb, &vb);
+        if (!more_a || !more_b) {
+            return (int) more_a - (int) more_b;
+        }
+        int c = value_compare(ka, kb);
+        if (c == 0) {
+            c = value_compare(va, vb);
+        }
+        if (c != 0) {
+            return c;
+        }
+    }
+}
+
+uint64_t btree_hash(const BTree* tree)
+{
+    // depends on the order of entries, which only depends on the keys
+    uint64_t hash = tree->size;
+    BTreeIter it;
+    Value* key;
+    Value* value;
+    btree_iter_init(&it, tree, NULL, NULL);
+    while (btree_iter_next(&it, &key, &value)) {
+        hash = hash * 31 + (value_hash(key) ^ (value_hash(value) * 0x9e3779b97f4a7c15ULL));
+    }
+    return hash;
+}
+
+/* Starts at the least key not less than lo, stops before hi */
+void btree_iter_init(BTreeIter* it, const BTree* tree, Value* lo, Value* hi)
+{
+    BTreeNode* node = tree->root;
+    for (int d = 0; d < tree->height; ++d) {
+        it->nodes[d] = node;
+        it->pos[d] = lo ? btree_child(node, lo) : 0;
+        node = node->slots[it->pos[d]];
+    }
+    it->depth = it->height = tree->height;
+    it->nodes[it->depth] = node;
+    it->pos[it->depth] = lo ? btree_lower(node, lo) : 0;
+    it->hi = hi;
+}
+
+bool btree_iter_next(BTreeIter* it, Value** key, Value** value)
+{
+    while (it->depth >= 0) {
+        BTreeNode* node = it->nodes[it->depth];
+        unsigned pos = it->pos[it->depth];
+        if (pos < node->n && it->depth < it->height) {
+            // inner levels move on to their next child once it is done
+            it->depth++;
+            it->nodes[it->depth] = node->slots[pos];
+            it->pos[it->depth] = 0;
+        } else if (pos < node->n) {
+            if (it->hi && value_compare(node->keys[pos], it->hi) >= 0) {
+                it->depth = -1;
+                return false;
+            }
+            it->pos[it->depth]++;
+            *key = node->keys[pos];
+            *value = node->slots[pos];
+            return true;
+        } else if (--it->depth >= 0) {
+            it->pos[it->depth]++;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,257 @@
+/*
+ * cmap.c
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "cmap.h"
+#include "gc.h"
+#include "log.h"
+
+/* Marks a removed entry. Its key is NULL, so no lookup ever matches it. */
+static CMapItem cmap_tombstone = { NULL, NULL, NULL };
+#define CMAP_TOMBSTONE (&cmap_tombstone)
+
+/* Grow once entries and tombstones fill 3/4 of the slots */
+#define CMAP_FULL(capacity) ((capacity) - (capacity) / 4)
+
+static CMapTable* cmap_table_new(size_t capacity)
+{
+    CMapTable* t = malloc(sizeof(CMapTable) + capacity * sizeof(CMapItem*));
+    t->capacity = capacity;
+    t->retired = NULL;
+    for (size_t i = 0; i < capacity; ++i) {
+        atomic_init(&t->slots[i], NULL);
+    }
+    return t;
+}
+
+/* Smallest capacity that holds n entries at a load factor of at most 1/2 */
+static size_t cmap_capacity_for(size_t n)
+{
+    size_t capacity = CMAP_MIN_CAPACITY;
+    while (capacity / 2 < n) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+static pthread_mutex_t* cmap_stripe(CMap* m, Symbol* key)
+{
+    /* the table indexes by the low bits, stripes use the high ones */
+    return &m->stripes[(key->hash >> 32) & (CMAP_STRIPES - 1)].lock;
+}
+
+static void cmap_root(CMap* m, void* value, bool root)
+{
+    if (!value) return;
+    pthread_mutex_lock(&m->gc_lock);
+    if (root) {
+        gc_make_root(&gc, value);
+    } else {
+        gc_unroot(&gc, value);
+    }
+    pthread_mutex_unlock(&m->gc_lock);
+}
+
+/* Retires a replaced or removed entry, its value is no longer held */
+static void cmap_retire(CMap* m, CMapItem* item)
+{
+    cmap_root(m, item->value, false);
+    CMapItem* head = atomic_load_explicit(&m->retired_items, memory_order_relaxed);
+    do {
+        item->retired = head;
+    } while (!atomic_compare_exchange_weak_explicit(&m->retired_items, &head, item,
+             memory_order_release, memory_order_relaxed));
+}
+
+CMap* cmap_new(size_t n)
+{
+    CMap* m = malloc(sizeof(CMap));
+    atomic_init(&m->table, cmap_table_new(cmap_capacity_for(n)));
+    atomic_init(&m->size, 0);
+    atomic_init(&m->used, 0);
+    for (int i = 0; i < CMAP_STRIPES; ++i) {
+        pthread_mutex_init(&m->stripes[i].lock, NULL);
+    }
+    pthread_mutex_init(&m->gc_lock, NULL);
+    atomic_init(&m->retired_items, NULL);
+    m->retired_tables = NULL;
+    return m;
+}
+
+void cmap_delete(CMap* m)
+{
+    cmap_reclaim(m);
+    CMapTable* t = atomic_load(&m->table);
+    for (size_t i = 0; i < t->capacity; ++i) {
+        CMapItem* item = atomic_load_explicit(&t->slots[i], memory_order_relaxed);
+        if (item && item != CMAP_TOMBSTONE) {
+            cmap_root(m, item->value, false);
+            free(item);
+        }
+    }
+    free(t);
+    for (int i = 0; i < CMAP_STRIPES; ++i) {
+        pthread_mutex_destroy(&m->stripes[i].lock);
+    }
+    pthread_mutex_destroy(&m->gc_lock);
+    free(m);
+}
+
+void* cmap_get(CMap* m, Symbol* key)
+{
+    CMapTable* t = atomic_load_explicit(&m->table, memory_order_acquire);
+    size_t mask = t->capacity - 1;
+    for (size_t i = key->hash & mask; ; i = (i + 1) & mask) {
+        CMapItem* item = atomic_load_explicit(&t->slots[i], memory_order_acquire);
+        if (!item) {
+            return NULL;
+        }
+        if (item->key == key) {
+            return item->value;
+        }
+    }
+}
+
+/*
+ * Replaces the slot array of a table that ran out of empty slots. Holding
+ * all stripes keeps writers out while the entries are copied, lookups
+ * carry on in the old array until the new one is published.
+ */
+static void cmap_grow(CMap* m, CMapTable* full)
+{
+    for (int i = 0; i < CMAP_STRIPES; ++i) {
+        pthread_mutex_lock(&m->stripes[i].lock);
+    }
+    CMapTable* old = atomic_load_explicit(&m->table, memory_order_relaxed);
+    if (old == full) {
+        // tombstones are dropped, so the table may just be rebuilt in place
+        size_t size = atomic_load_explicit(&m->size, memory_order_relaxed);
+        CMapTable* t = cmap_table_new(cmap_capacity_for(size + 1));
+        size_t mask = t->capacity - 1;
+        for (size_t i = 0; i < old->capacity; ++i) {
+            CMapItem* item = atomic_load_explicit(&old->slots[i], memory_order_relaxed);
+            if (item && item != CMAP_TOMBSTONE) {
+                size_t slot = item->key->hash & mask;
+                while (atomic_load_explicit(&t->slots[slot], memory_order_relaxed)) {
+                    slot = (slot + 1) & mask;
+                }
+                atomic_store_explicit(&t->slots[slot], item, memory_order_relaxed);
+            }
+        }
+        LOG_DEBUG("Resized concurrent map to %zu", t->capacity);
+        atomic_store_explicit(&m->used, size, memory_order_relaxed);
+        atomic_store_explicit(&m->table, t, memory_order_release);
+        old->retired = m->retired_tables;
+        m->retired_tables = old;
+    }
+    for (int i = CMAP_STRIPES - 1; i >= 0; --i) {
+        pthread_mutex_unlock(&m->stripes[i].lock);
+    }
+}
+
+void cmap_put(CMap* m, Symbol* key, void* value)
+{
+    CMapItem* item = malloc(sizeof(CMapItem));
+    item->key = key;
+    item->value = value;
+    item->retired = NULL;
+    // root before publishing, so that the map never holds an unrooted value
+    cmap_root(m, value, true);
+
+    pthread_mutex_t* lock = cmap_stripe(m, key);
+    for (;;) {
+        pthread_mutex_lock(lock);
+        /* The table only changes while all stripes are held */
+        CMapTable* t = atomic_load_explicit(&m->table, memory_order_acquire);
+        size_t mask = t->capacity - 1;
+        size_t start = key->hash & mask;
+        // update if exists, nobody else writes this key while we hold its stripe
+        for (size_t i = start; ; i = (i + 1) & mask) {
+            CMapItem* cur = atomic_load_explicit(&t->slots[i], memory_order_acquire);
+            if (!cur) {
+                break;
+            }
+            if (cur->key == key) {
+                atomic_store_explicit(&t->slots[i], item, memory_order_release);
+                pthread_mutex_unlock(lock);
+                cmap_retire(m, cur);
+                return;
+            }
+        }
+        // reserve an empty slot, so that concurrent inserts never fill the table
+        if (atomic_fetch_add(&m->used, 1) + 1 > CMAP_FULL(t->capacity)) {
+            atomic_fetch_sub(&m->used, 1);
+            pthread_mutex_unlock(lock);
+            cmap_grow(m, t);
+            continue;
+        }
+        /* Writers of other stripes may claim slots on the way, so claim the
+         * first free slot with a compare and swap. */
+        for (size_t i = start; ; i = (i + 1) & mask) {
+            CMapItem* cur = atomic_load_explicit(&t->slots[i], memory_order_relaxed);
+            if ((!cur || cur == CMAP_TOMBSTONE)
+                    && atomic_compare_exchange_strong_explicit(&t->slots[i], &cur, item,
+                            memory_order_release, memory_order_relaxed)) {
+                if (cur == CMAP_TOMBSTONE) {
+                    // reused a slot that was counted already
+                    atomic_fetch_sub(&m->used, 1);
+                }
+                break;
+            }
+        }
+        atomic_fetch_add(&m->size, 1);
+        pthread_mutex_unlock(lock);
+        return;
+    }
+}
+
+void cmap_remove(CMap* m, Symbol* key)
+{
+    // ignores unknown keys
+    pthread_mutex_t* lock = cmap_stripe(m, key);
+    pthread_mutex_lock(lock);
+    CMapTable* t = atomic_load_explicit(&m->table, memory_order_acquire);
+    size_t mask = t->capacity - 1;
+    for (size_t i = key->hash & mask; ; i = (i + 1) & mask) {
+        CMapItem* cur = atomic_load_explicit(&t->slots[i], memory_order_acquire);
+        if (!cur) {
+            break;
+        }
+        if (cur->key == key) {
+            /* The slot stays in use, later probes must continue past it */
+            atomic_store_explicit(&t->slots[i], CMAP_TOMBSTONE, memory_order_release);
+            atomic_fetch_sub(&m->size, 1);
+            cmap_retire(m, cur);
+            break;
+        }
+    }
+    pthread_mutex_unlock(lock);
+}
+
+size_t cmap_size(CMap* m)
+{
+    return atomic_load_explicit(&m->size, memory_order_relaxed);
+}
+
+void cmap_reclaim(CMap* m)
+{
+    CMapItem* item = atomic_exchange(&m->retired_items, NULL);
+    while (item) {
+        CMapItem* next = item->retired;
+        free(item);
+        item = next;
+    }
+    CMapTable* t = m->retired_tables;
+    while (t) {
+        CMapTable* next = t->retired;
+        free(t);
+        t = next;
+    }
+    m->retired_tables = NULL;
+}
@@ -14,7 +14,7 @@ Value* core_sum(Value* args)
 {
     if (!args) { // FIXME:  || !_is_list(args)) {
         if (args) {
-            LOG_CRITICAL("Not a list: %d", args->type);
+            LOG_CRITICAL("Not a list: %d", value_type(args));
         }
         return NULL;
     }
@@ -24,23 +24,170 @@ Value* core_sum(Value* args)
     List* list = args->value.list;
     LOG_DEBUG("Initial list size: %ld", list_size(list));
     while ((head = list_head(list)) != NULL) {
-        if (head->type == VALUE_FLOAT) {
-            sum += head->value.float_;
+        if (value_type(head) == VALUE_FLOAT) {
+            sum += value_float(head);
             all_int = false;
-        } else if (head->type == VALUE_INT) {
-            sum += (float) head->value.int_;
+        } else if (value_type(head) == VALUE_INT) {
+            sum += (float) value_int(head);
         } else {
-            LOG_CRITICAL("core.sum requires numeric arguments, got %d", head->type);
+            LOG_CRITICAL("core.sum requires numeric arguments, got %d", value_type(head));
         }
         list = list_tail(list);
     }
     Value* ret;
     if (all_int) {
         ret = value_new_int((int) sum);
-        LOG_DEBUG("apply returning: %d\n", ret->value.int_);
+        LOG_DEBUG("apply returning: %d\n", value_int(ret));
     } else {
         ret = value_new_float(sum); // FIXME: who frees this?
-        LOG_DEBUG("apply returning: %f\n", ret->value.float_);
+        LOG_DEBUG("apply returning: %f\n", value_float(ret));
     }
     return ret;
 }
+
+static Value* core_map_update(Value* map, List* kvs, bool assoc)
+{
+    bool sorted = value_type(map) == VALUE_SORTED_MAP;
+    Hamt* hamt = sorted ? NULL : map->value.hamt;
+    BTree* btree = sorted ? map->value.btree : NULL;
+    Value* key;
+    while ((key = list_head(kvs)) != NULL) {
+        kvs = list_tail(kvs);
+        if (assoc) {
+            Value* value = list_head(kvs);
+            if (!value) {
+                LOG_CRITICAL("Missing value for map key%s", "");
+                return NULL;
+            }
+            if (sorted) {
+                btree = btree_assoc(btree, key, value);
+            } else {
+                hamt = hamt_assoc(hamt, key, value);
+            }
+            kvs = list_tail(kvs);
+        } else if (sorted) {
+            btree = btree_dissoc(btree, key);
+        } else {
+            hamt = hamt_dissoc(hamt, key);
+        }
+    }
+    if (sorted) {
+        return btree == map->value.btree ? map : value_new_sorted_map(btree);
+    }
+    return hamt == map->value.hamt ? map : value_new_map(hamt);
+}
+
+static Value* core_map_arg(Value* args, const char* fn)
+{
+    Value* map = args ? list_head(args->value.list) : NULL;
+    if (!map || (value_type(map) != VALUE_MAP && value_type(map) != VALUE_SORTED_MAP)) {
+        LOG_CRITICAL("core.%s requires a map argument", fn);
+        return NULL;
+    }
+    return map;
+}
+
+Value* core_hash_map(Value* args)
+{
+    if (!args) return NULL;
+    return core_map_update(value_new_map(NULL), args->value.list, true);
+}
+
+Value* core_sorted_map(Value* args)
+{
+    if (!args) return NULL;
+    return core_map_update(value_new_sorted_map(NULL), args->value.list, true);
+}
+
+Value* core_assoc(Value* args)
+{
+    Value* map = core_map_arg(args, "assoc");
+    if (!map) return NULL;
+    return core_map_update(map, list_tail(args->value.list), true);
+}
+
+Value* core_dissoc(Value* args)
+{
+    Value* map = core_map_arg(args, "dissoc");
+    if (!map) return NULL;
+    return core_map_update(map, list_tail(args->value.list), false);
+}
+
+Value* core_get(Value* args)
+{
+    Value* map = core_map_arg(args, "get");
+    if (!map) return NULL;
+    Value* key = list_head(list_tail(args->value.list));
+    Value* value = NULL;
+    if (key) {
+        value = value_type(map) == VALUE_SORTED_MAP
+                ? btree_get(map->value.btree, key) : hamt_get(map->value.hamt, key);
+    }
+    return value ? value : value_new_nil();
+}
+
+/* (submap m lo hi) holds the entries of m with keys from lo up to hi, nil is unbounded */
+Value* core_submap(Value* args)
+{
+    Value* map = core_map_arg(args, "submap");
+    if (!map) return NULL;
+    if (value_type(map) != VALUE_SORTED_MAP) {
+        LOG_CRITICAL("core.submap requires a sorted map, got %d", value_type(map));
+        return NULL;
+    }
+    List* bounds = list_tail(args->value.list);
+    Value* lo = list_head(bounds);
+    Value* hi = list_head(list_tail(bounds));
+    lo = lo && value_type(lo) != VALUE_NIL ? lo : NULL;
+    hi = hi && value_type(hi) != VALUE_NIL ? hi : NULL;
+    BTree* slice = btree_slice(map->value.btree, lo, hi);
+    return slice == map->value.btree ? map : value_new_sorted_map(slice);
+}
+
+/* (count x) is the number of characters of a string or entries of a collection */
+Value* core_count(Value* args)
+{
+    Value* x = args ? list_head(args->value.list) : NULL;
+    if (!x) {
+        LOG_CRITICAL("core.count requires an argument%s", "");
+        return NULL;
+    }
+    switch (value_type(x)) {
+    case VALUE_STRING:
+        return value_new_int((int) x->value.string->length);
+    case VALUE_LIST:
+        return value_new_int((int) list_size(x->value.list));
+    case VALUE_MAP:
+        return value_new_int((int) hamt_size(x->value.hamt));
+    case VALUE_SORTED_MAP:
+        return value_new_int((int) btree_size(x->value.btree));
+    case VALUE_NIL:
+        return value_new_int(0);
+    default:
+        LOG_CRITICAL("core.count cannot count values of type %d", value_type(x));
+        return NULL;
+    }
+}
+
+/* (subs s start end) holds the characters of s from start up to end, or to its end */
+Value* core_subs(Value* args)
+{
+    Value* s = args ? list_head(args->value.list) : NULL;
+    if (!s || value_type(s) != VALUE_STRING) {
+        LOG_CRITICAL("core.subs requires a string argument%s", "");
+        return NULL;
+    }
+    List* bounds = list_tail(args->value.list);
+    Value* start = list_head(bounds);
+    Value* end = list_head(list_tail(bounds));
+    String* string = s->value.string;
+    if (!start || value_type(start) != VALUE_INT || value_int(start) < 0
+            || (end && (value_type(end) != VALUE_INT || value_int(end) < value_int(start)))
+            || (size_t) value_int(end ? end : start) > string->length) {
+        LOG_CRITICAL("core.subs requires indices within the string%s", "");
+        return NULL;
+    }
+    size_t to = end ? (size_t) value_int(end) : string->length;
+    String* slice = string_slice(string, (size_t) value_int(start), to);
+    return slice == string ? s : value_new_string_from(slice);
+}
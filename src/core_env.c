@@ -0,0 +1,22 @@
+/*
+ * core_env.c
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "core.h"
+
+/* Generated from core_env.def at build time */
+#include "core_env.gen.h"
+
+Environment* core_env_new()
+{
+    Symbol* keys[CORE_ENV_SIZE];
+    Value* values[CORE_ENV_SIZE];
+    for (size_t i = 0; i < CORE_ENV_SIZE; ++i) {
+        keys[i] = symbol_intern((char*) core_env_names[i]);
+        values[i] = value_new_fn(core_env_fns[i]);
+    }
+    return env_new_frozen(keys, values, CORE_ENV_SIZE, core_env_seeds, CORE_ENV_SEEDS);
+}
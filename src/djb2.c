@@ -51,3 +51,15 @@ unsigned long djb2(char *str)
     return hash;
 }
 
+/* The same hash over exactly len bytes, which need not be NUL-terminated */
+unsigned long djb2_len(const char *str, size_t len)
+{
+    const unsigned char* s = (const unsigned char*) str;
+    unsigned long hash = 5381;
+
+    for (size_t i = 0; i < len; ++i) {
+        hash = ((hash << 5) + hash) + s[i]; /* hash * 33 + c */
+    }
+
+    return hash;
+}
@@ -10,34 +10,214 @@
 #include "log.h"
 #include "value.h"
 
+uint64_t env_version = 1;
+
 Environment* env_new(Environment* parent)
 {
     Environment* env = gc_malloc(&gc, sizeof(Environment));
     env->parent = parent;
-    env->kv = map_new(32);
+    env->kv = map_new(0);
+    env->bindings = NULL;
+    env->nslots = 0;
+    env->slots = NULL;
     return env;
 }
 
-void env_delete(Environment* env)
+Environment* env_new_frame(Environment* parent, size_t nslots)
+{
+    Environment* env = gc_calloc(&gc, 1, sizeof(Environment) + nslots * sizeof(Value*));
+    env->parent = parent;
+    env->kv = NULL;
+    env->bindings = NULL;
+    env->nslots = nslots;
+    env->slots = (Value**) (env + 1);
+    return env;
+}
+
+static void env_bind(Environment* env, Symbol* symbol, Value* value)
 {
+    env->bindings = hamt_assoc(env->bindings, value_symbol(symbol), value);
+}
+
+/* An environment without parent over a frozen map, see map_new_frozen() */
+Environment* env_new_frozen(Symbol** symbols, Value** values, size_t n,
+                            const uint32_t* seeds, size_t nseeds)
+{
+    Environment* env = env_new(NULL);
     map_delete(env->kv);
+    env->kv = map_new_frozen(symbols, (void**) values, n, seeds, nseeds);
+    return env;
+}
+
+/* Copies the map of an environment into its bindings, in one go */
+static void env_build_bindings(Environment* env)
+{
+    size_t n = env->kv->size;
+    MapItem** items = gc_malloc(&gc, (n ? n : 1) * sizeof(MapItem*));
+    map_items(env->kv, items);
+    Hamt* bindings = hamt_new();
+    for (size_t i = 0; i < n; ++i) {
+        bindings = hamt_assoc(bindings, value_symbol(items[i]->key), items[i]->value);
+    }
+    gc_free(&gc, items);
+    env->bindings = bindings;
+}
+
+/*
+ * Takes a snapshot of an environment and all its parents. Snapshots share
+ * the bindings of the environments and the slots of the frames, so that
+ * taking one costs a header per environment on the chain. The first
+ * snapshot of an environment is the exception: it copies the whole map
+ * into bindings, which takes time linear in the number of bindings, and
+ * from then on every definition in that environment path copies them too.
+ * Lookups in a snapshot only read, several threads may do them at once,
+ * but eval() against snapshots is not thread safe yet, see env.h.
+ */
+Environment* env_snapshot(Environment* env)
+{
+    if (!env) return NULL;
+    if (env->kv && !env->bindings) {
+        env_build_bindings(env);
+    }
+    Environment* snapshot = gc_malloc(&gc, sizeof(Environment));
+    snapshot->parent = env_snapshot(env->parent);
+    snapshot->kv = NULL;
+    snapshot->bindings = env->bindings;
+    // frame slots are set once, when the frame is entered
+    snapshot->nslots = env->nslots;
+    snapshot->slots = env->slots;
+    return snapshot;
+}
+
+void env_delete(Environment* env)
+{
+    if (env->kv) {
+        map_delete(env->kv);
+    }
+    if (env->kv || env->bindings) {
+        env_version++;
+    }
     gc_free(&gc, env);
 }
 
-void env_set(Environment* env, char* symbol, Value* value)
+void env_set(Environment* env, Symbol* symbol, Value* value)
 {
-    map_put(env->kv, symbol, value, sizeof(Value));
+    // frames have no names, definitions go to the closest map or snapshot
+    env = env_scope(env);
+    if (env->bindings) {
+        // once snapshotted, the bindings follow the map, see env_snapshot()
+        env_bind(env, symbol, value);
+    }
+    if (!env->kv) {
+        // the snapshot's bindings are new nodes now
+        env_version++;
+        return;
+    }
+    Value** cell = (Value**) map_get_cell(env->kv, symbol);
+    if (cell) {
+        // redefinition, the cell stays where it is
+        *cell = value;
+        return;
+    }
+    map_put(env->kv, symbol, value);
+    env_version++;
+}
+
+/* The cell of a symbol in one environment, or NULL */
+static Value** env_lookup(Environment* env, Symbol* symbol)
+{
+    if (env->kv) {
+        return (Value**) map_get_cell(env->kv, symbol);
+    }
+    if (env->bindings) {
+        // a key on the stack, value_symbol() may allocate and lookups only read
+        Value key = { .type = VALUE_SYMBOL, .value.symbol = symbol };
+        return hamt_get_cell(env->bindings, &key);
+    }
+    return NULL;
 }
 
-Value* env_get(Environment* env, char* symbol)
+/*
+ * The cell that holds the value of a symbol. It keeps its address until
+ * the environment of the binding is deleted, see env_version.
+ */
+Value** env_get_cell(Environment* env, Symbol* symbol)
 {
     Environment* cur_env = env;
     while(cur_env) {
-        void* value = map_get(cur_env->kv, symbol);
-        if (value) {
-            return value;
+        Value** cell = env_lookup(cur_env, symbol);
+        if (cell) {
+            return cell;
         }
         cur_env = cur_env->parent;
     }
     return NULL;
 }
+
+Value* env_get(Environment* env, Symbol* symbol)
+{
+    Value** cell = env_get_cell(env, symbol);
+    return cell ? *cell : NULL;
+}
+
+/*
+ * Resolves the cells of n symbols, ENV_BATCH at a time. Each environment on
+ * the way up looks up all symbols that are still unresolved with a single
+ * map_get_cells(). Returns the number of symbols found, cells[i] is NULL
+ * for the others.
+ */
+size_t env_get_cells(Environment* env, Symbol** symbols, Value*** cells, size_t n)
+{
+    size_t found = 0;
+    for (size_t start = 0; start < n; start += ENV_BATCH) {
+        Symbol* pending[ENV_BATCH];
+        size_t index[ENV_BATCH];
+        void** hits[ENV_BATCH];
+        size_t npending = n - start < ENV_BATCH ? n - start : ENV_BATCH;
+        for (size_t i = 0; i < npending; ++i) {
+            pending[i] = symbols[start + i];
+            index[i] = start + i;
+            cells[start + i] = NULL;
+        }
+        for (Environment* cur_env = env; cur_env && npending; cur_env = cur_env->parent) {
+            if (cur_env->kv) {
+                map_get_cells(cur_env->kv, pending, hits, npending);
+            } else if (cur_env->bindings) {
+                for (size_t i = 0; i < npending; ++i) {
+                    hits[i] = (void**) env_lookup(cur_env, pending[i]);
+                }
+            } else {
+                continue;
+            }
+            size_t k = 0;
+            for (size_t i = 0; i < npending; ++i) {
+                if (hits[i]) {
+                    cells[index[i]] = (Value**) hits[i];
+                    found++;
+                } else {
+                    // still unresolved, try the parent
+                    pending[k] = pending[i];
+                    index[k] = index[i];
+                    k++;
+                }
+            }
+            npending = k;
+        }
+    }
+    return found;
+}
+
+/* Resolves the values of n symbols, see env_get_cells() */
+size_t env_get_many(Environment* env, Symbol** symbols, Value** values, size_t n)
+{
+    size_t found = 0;
+    for (size_t start = 0; start < n; start += ENV_BATCH) {
+        Value** cells[ENV_BATCH];
+        size_t m = n - start < ENV_BATCH ? n - start : ENV_BATCH;
+        found += env_get_cells(env, symbols + start, cells, m);
+        for (size_t i = 0; i < m; ++i) {
+            values[start + i] = cells[i] ? *cells[i] : NULL;
+        }
+    }
+    return found;
+}
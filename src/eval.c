@@ -13,69 +13,211 @@
 
 static bool _is_self_evaluating(const Value* value)
 {
-    return value->type == VALUE_FLOAT
-        || value->type == VALUE_INT
-        || value->type == VALUE_STRING
-        || value->type == VALUE_NIL
-        || value->type == VALUE_FN;
+    return value_type(value) == VALUE_FLOAT
+        || value_type(value) == VALUE_INT
+        || value_type(value) == VALUE_STRING
+        || value_type(value) == VALUE_NIL
+        || value_type(value) == VALUE_BOOL
+        || value_type(value) == VALUE_FN
+        || value_type(value) == VALUE_MAP
+        || value_type(value) == VALUE_SORTED_MAP
+        || value_type(value) == VALUE_LAMBDA;
 }
 
 static bool _is_symbol(const Value* value)
 {
-    return value->type == VALUE_SYMBOL;
+    return value_type(value) == VALUE_SYMBOL;
 }
 
 static bool _is_fn(const Value* value)
 {
-    return value->type == VALUE_FN;
+    return value_type(value) == VALUE_FN;
 }
 
 static bool _is_list(const Value* value)
 {
-    return value->type == VALUE_LIST;
+    return value_type(value) == VALUE_LIST;
 }
 
+static bool _is_global(const Value* value)
+{
+    return value_type(value) == VALUE_GLOBAL;
+}
+
+/*
+ * Whether a global has to be looked up again, because its cell may be
+ * stale or was found in another environment
+ */
+static bool _is_stale(const Value* value, Environment* scope)
+{
+    return _is_global(value)
+           && (value->value.global.version != env_version || value->value.global.env != scope);
+}
+
+static void _cache_global(Value* global, Value** cell, Environment* scope)
+{
+    global->value.global.cell = cell;
+    global->value.global.env = scope;
+    global->value.global.version = env_version;
+}
+
+static bool _is_form(const Value* value, Symbol* name)
+{
+    Value* head = list_head(value->value.list);
+    return head && _is_symbol(head) && head->value.symbol == name;
+}
+
+/* Evaluates a body in order and returns the value of its last expression */
+static Value* _eval_body(List* body, Environment* env)
+{
+    Value* result = value_new_nil();
+    Value* head;
+    while ((head = list_head(body)) != NULL) {
+        if ((result = eval(head, env)) == NULL) {
+            return NULL;
+        }
+        body = list_tail(body);
+    }
+    return result;
+}
+
+/* (let (name init ...) body ...) binds the names to the slots of a new frame */
+static Value* _eval_let(Value* expr, Environment* env)
+{
+    List* rest = list_tail(expr->value.list);
+    List* pairs = ((Value*) list_head(rest))->value.list;
+    Environment* frame = env_new_frame(env, list_size(pairs) / 2);
+    for (size_t i = 0; list_head(pairs) != NULL; ++i) {
+        pairs = list_tail(pairs);
+        if ((frame->slots[i] = eval(list_head(pairs), env)) == NULL) {
+            return NULL;
+        }
+        pairs = list_tail(pairs);
+    }
+    return _eval_body(list_tail(rest), frame);
+}
+
+/* (lambda (name ...) body ...) closes over the current environment */
+static Value* _eval_lambda(Value* expr, Environment* env)
+{
+    List* rest = list_tail(expr->value.list);
+    Value* body = value_new_list();
+    body->value.list = list_tail(rest);
+    return value_new_lambda(list_head(rest), body, env);
+}
+
+/*
+ * Evaluates an expression that has been through ir_resolve(). Variables of
+ * lets and lambdas are read from their frame slots. Every other variable
+ * caches the cell of its binding at its use site and only looks its
+ * symbol up again after env_version has changed or when it is evaluated
+ * in another environment, so that a global costs a single load while
+ * redefinitions still show. Frames do not count as another environment,
+ * see env_scope().
+ */
 Value* eval(Value* expr, Environment* env)
 {
+    static Symbol* let = NULL;
+    static Symbol* lambda = NULL;
+    if (!let) {
+        let = symbol_intern("let");
+        lambda = symbol_intern("lambda");
+    }
     if (!expr) return NULL;
     if (_is_self_evaluating(expr) || _is_fn(expr)) {
         // atoms and built-ins self-evaluate
-        LOG_DEBUG("Atom/Builtin: %d\n", expr->type);
+        LOG_DEBUG("Atom/Builtin: %d\n", value_type(expr));
         return expr;
     } else if (_is_symbol(expr)) {
-        LOG_DEBUG("Symbol: %s\n", expr->value.str);
+        LOG_DEBUG("Symbol: %s\n", expr->value.symbol->name);
         // resolve symbols or fail
         Value* sym;
-        if ((sym = env_get(env, expr->value.str)) == NULL) {
-            LOG_CRITICAL("Unknown symbol: %s", expr->value.str);
+        if ((sym = env_get(env, expr->value.symbol)) == NULL) {
+            LOG_CRITICAL("Unknown symbol: %s", expr->value.symbol->name);
         }
         return sym;
+    } else if (value_type(expr) == VALUE_GLOBAL) {
+        Environment* scope = env_scope(env);
+        if (_is_stale(expr, scope)) {
+            _cache_global(expr, env_get_cell(scope, expr->value.global.symbol), scope);
+        }
+        if (!expr->value.global.cell) {
+            LOG_CRITICAL("Unknown symbol: %s", expr->value.global.symbol->name);
+            return NULL;
+        }
+        return *expr->value.global.cell;
+    } else if (value_type(expr) == VALUE_LOCAL) {
+        Value* local = env_get_local(env, expr->value.local.depth, expr->value.local.slot);
+        if (!local) {
+            LOG_CRITICAL("Unbound variable: %s", expr->value.local.symbol->name);
+        }
+        return local;
+    } else if (_is_list(expr) && _is_form(expr, let)) {
+        return _eval_let(expr, env);
+    } else if (_is_list(expr) && _is_form(expr, lambda)) {
+        return _eval_lambda(expr, env);
     } else if (_is_list(expr)) {
-        LOG_DEBUG("List: %d\n", expr->type);
+        LOG_DEBUG("List: %d\n", value_type(expr));
         // eval every element of a list
         List* list = expr->value.list;
         List* evaluated_list = list_new();
-        Value* head;
-        Value* evaluated_head;
-        while ((head = list_head(list)) != NULL) {
-            // printf("Evaluating%s ", ":"); value_print(head); printf("\n");
-            evaluated_head = eval(head, env);
-            // printf("Returns%s ", ":"); value_print(evaluated_head); printf("\n");
-            if (!evaluated_head) {
-                // eval failed
-                LOG_DEBUG("Eval %s", "failed");
-                return NULL; // FIXME: mem managment
+        Value* batch[ENV_BATCH];
+        Symbol* symbols[ENV_BATCH];
+        Value** resolved[ENV_BATCH];
+        bool stale[ENV_BATCH];
+        Environment* scope = env_scope(env);
+        while (list_head(list) != NULL) {
+            /* Symbols and globals without a cell are resolved a batch at a
+             * time, so that their lookups overlap. The other elements are
+             * evaluated in order. */
+            size_t n = 0, nsymbols = 0;
+            Value* head;
+            while (n < ENV_BATCH && (head = list_head(list)) != NULL) {
+                stale[n] = _is_stale(head, scope);
+                batch[n++] = head;
+                if (_is_symbol(head)) {
+                    symbols[nsymbols++] = head->value.symbol;
+                } else if (stale[n - 1]) {
+                    symbols[nsymbols++] = head->value.global.symbol;
+                }
+                list = list_tail(list);
+            }
+            env_get_cells(scope, symbols, resolved, nsymbols);
+            uint64_t version = env_version;
+            for (size_t i = 0, s = 0; i < n; ++i) {
+                Value* evaluated_head;
+                if (_is_symbol(batch[i])) {
+                    Value** cell = resolved[s++];
+                    if ((evaluated_head = cell ? *cell : NULL) == NULL) {
+                        LOG_CRITICAL("Unknown symbol: %s", batch[i]->value.symbol->name);
+                    }
+                } else {
+                    Value* global = batch[i];
+                    if (stale[i]) {
+                        // unless an element before has changed the bindings
+                        Value** cell = resolved[s++];
+                        if (env_version == version) {
+                            _cache_global(global, cell, scope);
+                        }
+                    }
+                    evaluated_head = eval(batch[i], env);
+                }
+                if (!evaluated_head) {
+                    // eval failed
+                    LOG_DEBUG("Eval %s", "failed");
+                    return NULL; // FIXME: mem managment
+                }
+                list_append(evaluated_list, evaluated_head);
+                // FIXME: we should delete head here
             }
-            list_append(evaluated_list, evaluated_head, sizeof(Value));
-            list = list_tail(list);
-            // FIXME: we should delete head here
-            // value_print(evaluated_head); printf("\n");
         }
-        expr->value.list = evaluated_list; // FIXME: and delete the old list here
-        // ok, all elements have been evaluated, so let's apply
-        return apply(expr, env);
+        // ok, all elements have been evaluated, so let's apply. The
+        // expression stays as it is, lambda bodies are evaluated again.
+        Value* call = value_new_list();
+        call->value.list = evaluated_list;
+        return apply(call, env);
     } else {
-        LOG_CRITICAL("Unknown expression: %d", expr->type);
+        LOG_CRITICAL("Unknown expression: %d", value_type(expr));
     }
     return NULL;
 }
@@ -85,13 +227,29 @@ Value* apply(Value* expr, Environment* env)
     // we expect a list with (fn arg1 arg2 ...)
     if (!expr || !_is_list(expr)) {
         if (expr) {
-            LOG_CRITICAL("Not a list: %d", expr->type);
+            LOG_CRITICAL("Not a list: %d", value_type(expr));
         }
         return NULL;
     }
     // value_print(expr); printf("\n");
     Value* fn = list_head(expr->value.list);
-    if (fn->type != VALUE_FN) {
+    if (value_type(fn) == VALUE_LAMBDA) {
+        // the arguments fill the slots of a new frame in order
+        List* params = fn->value.fun.args->value.list;
+        List* args = list_tail(expr->value.list);
+        if (list_size(args) != list_size(params)) {
+            LOG_CRITICAL("Lambda takes %zu arguments, got %zu", list_size(params),
+                         list_size(args));
+            return NULL;
+        }
+        Environment* frame = env_new_frame(fn->value.fun.env, list_size(params));
+        for (size_t i = 0; i < frame->nslots; ++i) {
+            frame->slots[i] = list_head(args);
+            args = list_tail(args);
+        }
+        return _eval_body(fn->value.fun.body->value.list, frame);
+    }
+    if (value_type(fn) != VALUE_FN) {
         LOG_CRITICAL("Cannot apply non-function value.%s", "");
         return NULL;
     }
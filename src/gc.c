@@ -8,13 +8,15 @@
  */
 
 #include "gc.h"
+#include "heap.h"
 #include "log.h"
 
 #include <errno.h>
+#include <execinfo.h>
 #include <setjmp.h>
 #include <stdlib.h>
 #include <string.h>
-#include "primes.h"
+#include <time.h>
 
 /*
  * Set log level for this compilation unit. If set to LOGLEVEL_DEBUG,
@@ -35,69 +37,164 @@
 
 /*
  * Store allocations in a hash map with the pointer address
- * as the key.
+ * as the key. The map is generated from the hash table template
+ * in table.h.
  */
 
 
+struct GcProfileSite;
+
 typedef struct Allocation {
     void* ptr;                // mem pointer
     size_t size;              // allocated size in bytes
     char tag;
+    unsigned roots;           // gc_make_root() calls not yet undone by gc_unroot()
     void (*dtor)(void*);      // destructor
-    struct Allocation* next;  // separate chaining
+    struct GcProfileSite* site; // profiler sample site, NULL if unsampled
+    uint64_t trace_id;        // allocation trace id, 0 if untraced
 } Allocation;
 
+/*
+ * Allocations are aligned, so the low bits of their addresses carry almost
+ * no information. Mix all bits into the ones the table indexes by.
+ */
+static inline uint64_t gc_hash(void* ptr)
+{
+    uint64_t h = (uint64_t) (uintptr_t) ptr;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+#define TABLE_TYPE AllocationSlots
+#define TABLE_PREFIX gc_slots
+#define TABLE_KEY void*
+#define TABLE_ENTRY Allocation*
+#define TABLE_ENTRY_KEY(a) ((a)->ptr)
+#define TABLE_HASH(k) gc_hash(k)
+#define TABLE_EQUAL(a, b) ((a) == (b))
+#include "table.h"
+
 typedef struct AllocationMap {
-    size_t capacity;
     size_t min_capacity;
     double downsize_factor;
     double upsize_factor;
     double sweep_factor;
     size_t sweep_limit;
+    size_t upsize_limit;      // grow once size exceeds this
+    size_t downsize_limit;    // shrink once size drops below this
     size_t size;
-    Allocation** allocs;
+    AllocationSlots allocs;
+    Heap* heap;               // source of the metadata, NULL for the system allocator
 } AllocationMap;
 
 GarbageCollector gc; // global GC object
 
-static Allocation* gc_allocation_new(void* ptr, size_t size, void (*dtor)(void*))
+/*
+ * Metadata normally comes from the system allocator. A fixed heap has to
+ * hold the collector's own bookkeeping as well, so that nothing is ever
+ * malloc'd once the collector is running.
+ */
+static void* gc_meta_alloc(Heap* heap, size_t size)
+{
+    return heap ? heap_alloc(heap, size) : malloc(size);
+}
+
+static void gc_meta_free(Heap* heap, void* ptr, size_t size)
 {
-    Allocation* a = (Allocation*) malloc(sizeof(Allocation));
+    if (heap) {
+        heap_free(heap, ptr, size);
+    } else {
+        free(ptr);
+    }
+}
+
+static Allocation* gc_allocation_new(Heap* heap, void* ptr, size_t size,
+                                     void (*dtor)(void*))
+{
+    Allocation* a = (Allocation*) gc_meta_alloc(heap, sizeof(Allocation));
+    if (!a) return NULL;
     a->ptr = ptr;
     a->size = size;
     a->tag = GC_TAG_NONE;
+    a->roots = 0;
     a->dtor = dtor;
-    a->next = NULL;
+    a->site = NULL;
+    a->trace_id = 0;
     return a;
 }
 
-static void gc_allocation_delete(Allocation* a)
+static void gc_allocation_delete(Heap* heap, Allocation* a)
 {
-    free(a);
+    gc_meta_free(heap, a, sizeof(Allocation));
 }
 
 static double gc_allocation_map_load_factor(AllocationMap* am)
 {
-    return (double) am->size / (double) am->capacity;
+    return (double) am->size / (double) am->allocs.capacity;
+}
+
+/*
+ * Turns the load factors into entry counts for the current capacity, so
+ * that puts and removes compare sizes instead of dividing.
+ */
+static void gc_allocation_map_set_limits(AllocationMap* am)
+{
+    double up = am->upsize_factor * am->allocs.capacity;
+    double down = am->downsize_factor * am->allocs.capacity;
+    am->upsize_limit = (size_t) up;
+    am->downsize_limit = (size_t) down;
+    if ((double) am->downsize_limit < down) {
+        // sizes below a fractional limit include its integer part
+        am->downsize_limit++;
+    }
+}
+
+/* Smallest capacity of the table that is at least n */
+static size_t gc_allocation_map_capacity(size_t n)
+{
+    size_t capacity = TABLE_GROUP_SIZE;
+    while (capacity < n) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+static bool gc_allocation_map_alloc_slots(AllocationMap* am, size_t capacity)
+{
+    void* block = gc_meta_alloc(am->heap, gc_slots_bytes(capacity));
+    if (!block) return false;
+    gc_slots_init(&am->allocs, block, capacity);
+    return true;
 }
 
-static AllocationMap* gc_allocation_map_new(size_t min_capacity,
+static AllocationMap* gc_allocation_map_new(Heap* heap,
+        size_t min_capacity,
         size_t capacity,
         double sweep_factor,
         double downsize_factor,
         double upsize_factor)
 {
-    AllocationMap* am = (AllocationMap*) malloc(sizeof(AllocationMap));
-    am->min_capacity = next_prime(min_capacity);
-    am->capacity = next_prime(capacity);
-    if (am->capacity < am->min_capacity) am->capacity = am->min_capacity;
+    AllocationMap* am = (AllocationMap*) gc_meta_alloc(heap, sizeof(AllocationMap));
+    if (!am) return NULL;
+    am->heap = heap;
+    am->min_capacity = gc_allocation_map_capacity(min_capacity);
+    capacity = gc_allocation_map_capacity(capacity);
+    if (capacity < am->min_capacity) capacity = am->min_capacity;
+    if (!gc_allocation_map_alloc_slots(am, capacity)) {
+        gc_meta_free(heap, am, sizeof(AllocationMap));
+        return NULL;
+    }
     am->sweep_factor = sweep_factor;
-    am->sweep_limit = (int) (sweep_factor * am->capacity);
+    am->sweep_limit = (int) (sweep_factor * am->allocs.capacity);
     am->downsize_factor = downsize_factor;
     am->upsize_factor = upsize_factor;
-    am->allocs = (Allocation**) calloc(am->capacity, sizeof(Allocation*));
+    gc_allocation_map_set_limits(am);
     am->size = 0;
-    LOG_DEBUG("Created allocation map (cap=%ld, siz=%ld)", am->capacity, am->size);
+    LOG_DEBUG("Created allocation map (cap=%ld, siz=%ld)", am->allocs.capacity, am->size);
     return am;
 }
 
@@ -105,53 +202,42 @@ static void gc_allocation_map_delete(AllocationMap* am)
 {
     // Iterate over the map
     LOG_DEBUG("Deleting allocation map (cap=%ld, siz=%ld)",
-              am->capacity, am->size);
-    Allocation *alloc, *tmp;
-    for (size_t i = 0; i < am->capacity; ++i) {
-        if ((alloc = am->allocs[i])) {
-            // Make sure to follow the chain inside a bucket
-            while (alloc) {
-                tmp = alloc;
-                alloc = alloc->next;
-                // free the management structure
-                gc_allocation_delete(tmp);
-            }
+              am->allocs.capacity, am->size);
+    for (size_t i = 0; i < am->allocs.capacity; ++i) {
+        if (gc_slots_full(&am->allocs, i)) {
+            // free the management structure
+            gc_allocation_delete(am->heap, am->allocs.slots[i]);
         }
     }
-    free(am->allocs);
-    free(am);
+    gc_meta_free(am->heap, am->allocs.ctrl, gc_slots_bytes(am->allocs.capacity));
+    gc_meta_free(am->heap, am, sizeof(AllocationMap));
 }
 
-static size_t gc_hash(void *ptr)
+static bool gc_allocation_map_resize(AllocationMap* am, size_t new_capacity)
 {
-    return ((uintptr_t)ptr) >> 3;
-}
-
-static void gc_allocation_map_resize(AllocationMap* am, size_t new_capacity)
-{
-    if (new_capacity <= am->min_capacity) {
-        return;
+    if (new_capacity < am->min_capacity
+            || new_capacity - new_capacity / 8 <= am->size) {
+        return false;
     }
-    // Replaces the existing items array in the hash table
-    // with a resized one and pushes items into the new, correct buckets
+    // Replaces the existing slots of the hash table
+    // with a resized set and pushes items into the new slots
     LOG_DEBUG("Resizing allocation map (cap=%ld, siz=%ld) -> (cap=%ld)",
-              am->capacity, am->size, new_capacity);
-    Allocation** resized_allocs = calloc(new_capacity, sizeof(Allocation*));
-
-    for (size_t i = 0; i < am->capacity; ++i) {
-        Allocation* alloc = am->allocs[i];
-        while (alloc) {
-            Allocation* next_alloc = alloc->next;
-            size_t new_index = gc_hash(alloc->ptr) % new_capacity;
-            alloc->next = resized_allocs[new_index];
-            resized_allocs[new_index] = alloc;
-            alloc = next_alloc;
+              am->allocs.capacity, am->size, new_capacity);
+    AllocationSlots old = am->allocs;
+    if (!gc_allocation_map_alloc_slots(am, new_capacity)) {
+        /* Keep going with the current table, only the load factor suffers */
+        LOG_DEBUG("Failed to resize allocation map (cap=%ld)", am->allocs.capacity);
+        return false;
+    }
+    for (size_t i = 0; i < old.capacity; ++i) {
+        if (gc_slots_full(&old, i)) {
+            gc_slots_place(&am->allocs, old.slots[i]);
         }
     }
-    free(am->allocs);
-    am->capacity = new_capacity;
-    am->allocs = resized_allocs;
-    am->sweep_limit = am->size + am->sweep_factor * (am->capacity - am->size);
+    gc_meta_free(am->heap, old.ctrl, gc_slots_bytes(old.capacity));
+    am->sweep_limit = am->size + am->sweep_factor * (am->allocs.capacity - am->size);
+    gc_allocation_map_set_limits(am);
+    return true;
 }
 
 
@@ -160,42 +246,36 @@ static Allocation* gc_allocation_map_put(AllocationMap* am,
         size_t size,
         void (*dtor)(void*))
 {
-    size_t index = gc_hash(ptr) % am->capacity;
-    LOG_DEBUG("PUT request for allocation ix=%ld", index);
-    Allocation* alloc = gc_allocation_new(ptr, size, dtor);
-    Allocation* cur = am->allocs[index];
-    Allocation* prev = NULL;
+    Allocation* alloc = gc_allocation_new(am->heap, ptr, size, dtor);
+    if (!alloc) return NULL;
     /* Upsert if ptr is already known (e.g. dtor update). */
-    while(cur != NULL) {
-        if (cur->ptr == ptr) {
-            // found it
-            alloc->next = cur->next;
-            if (!prev) {
-                // position 0
-                am->allocs[index] = alloc;
-            } else {
-                // in the list
-                prev->next = alloc;
-            }
-            gc_allocation_delete(cur);
-            LOG_DEBUG("AllocationMap Upsert at ix=%ld", index);
-            return alloc;
-
+    size_t slot = gc_slots_find(&am->allocs, ptr);
+    if (slot < am->allocs.capacity) {
+        Allocation* cur = am->allocs.slots[slot];
+        alloc->site = cur->site;
+        alloc->trace_id = cur->trace_id;
+        am->allocs.slots[slot] = alloc;
+        gc_allocation_delete(am->heap, cur);
+        LOG_DEBUG("AllocationMap Upsert at ix=%ld", slot);
+        return alloc;
+    }
+    /* The table must keep an empty slot, grow before taking the last one */
+    slot = gc_slots_find_free(&am->allocs, gc_hash(ptr));
+    if (gc_slots_exhausts(&am->allocs, slot)) {
+        if (!gc_allocation_map_resize(am, am->allocs.capacity * 2)) {
+            gc_allocation_delete(am->heap, alloc);
+            return NULL;
         }
-        prev = cur;
-        cur = cur->next;
+        slot = gc_slots_find_free(&am->allocs, gc_hash(ptr));
     }
-    /* Insert at the front of the separate chaining list */
-    cur = am->allocs[index];
-    alloc->next = cur;
-    am->allocs[index] = alloc;
+    gc_slots_place_at(&am->allocs, slot, alloc);
     am->size++;
-    LOG_DEBUG("AllocationMap insert at ix=%ld", index);
+    LOG_DEBUG("AllocationMap insert at ix=%ld", slot);
     /* Test if we need to increase the size of the allocation map */
-    double load_factor = gc_allocation_map_load_factor(am);
-    if (load_factor > am->upsize_factor) {
-        LOG_DEBUG("Load factor %0.3g > %0.3g. Triggering upsize.", load_factor, am->upsize_factor);
-        gc_allocation_map_resize(am, next_prime(am->capacity * 2));
+    if (am->size > am->upsize_limit) {
+        LOG_DEBUG("Load factor %0.3g > %0.3g. Triggering upsize.",
+                  gc_allocation_map_load_factor(am), am->upsize_factor);
+        gc_allocation_map_resize(am, am->allocs.capacity * 2);
     }
     return alloc;
 }
@@ -203,67 +283,341 @@ static Allocation* gc_allocation_map_put(AllocationMap* am,
 
 static Allocation* gc_allocation_map_get(AllocationMap* am, void* ptr)
 {
-    size_t index = gc_hash(ptr) % am->capacity;
-    // LOG_DEBUG("GET request for allocation ix=%ld (ptr=%p)", index, ptr);
-    Allocation* cur = am->allocs[index];
-    while(cur) {
-        if (cur->ptr == ptr) return cur;
-        cur = cur->next;
-    }
-    return NULL;
+    size_t slot = gc_slots_find(&am->allocs, ptr);
+    // LOG_DEBUG("GET request for allocation ix=%ld (ptr=%p)", slot, ptr);
+    return slot < am->allocs.capacity ? am->allocs.slots[slot] : NULL;
 }
 
 
 static void gc_allocation_map_remove(AllocationMap* am, void* ptr)
 {
     // ignores unknown keys
-    size_t index = gc_hash(ptr) % am->capacity;
-    Allocation* cur = am->allocs[index];
-    Allocation* prev = NULL;
-    while(cur != NULL) {
-        if (cur->ptr == ptr) {
-            // found it
-            if (!prev) {
-                // first item in list
-                am->allocs[index] = cur->next;
-            } else {
-                // not the first item in the list
-                prev->next = cur->next;
-            }
-            gc_allocation_delete(cur);
-            am->size--;
+    size_t slot = gc_slots_find(&am->allocs, ptr);
+    if (slot == am->allocs.capacity) {
+        return;
+    }
+    gc_allocation_delete(am->heap, am->allocs.slots[slot]);
+    gc_slots_erase(&am->allocs, slot);
+    am->size--;
+    if (am->size < am->downsize_limit) {
+        LOG_DEBUG("Load factor %0.3g < %0.3g. Triggering downsize.",
+                  gc_allocation_map_load_factor(am), am->downsize_factor);
+        gc_allocation_map_resize(am, am->allocs.capacity / 2);
+    }
+}
+
+
+/*
+ * Sampling heap profiler. Sample sites are keyed by their raw call stack and
+ * kept in a chained hash table of their own. All profiler bookkeeping uses
+ * the system allocator so that profiling does not perturb the managed heap.
+ */
+#define GC_PROFILE_MAX_DEPTH 32
+#define GC_PROFILE_MAX_SKIP 8
+#define GC_PROFILE_BUCKETS 1021
+
+typedef struct GcProfileSite {
+    int depth;
+    void* frames[GC_PROFILE_MAX_DEPTH];
+    size_t alloc_bytes;
+    size_t live_bytes;
+    size_t survivals;
+    struct GcProfileSite* next;
+} GcProfileSite;
+
+typedef struct GcProfile {
+    size_t interval;          // mean number of bytes between samples
+    size_t countdown;         // bytes left until the next sample
+    GcProfileSite* sites[GC_PROFILE_BUCKETS];
+} GcProfile;
+
+/* Public allocation entry points, stripped from the inner end of stacks. */
+static const char* gc_profile_entry_points[] = {
+    "gc_malloc", "gc_malloc_ext", "gc_calloc", "gc_calloc_ext", "gc_realloc", NULL
+};
+
+static size_t gc_profile_weight(GcProfile* prof, size_t size)
+{
+    return size > prof->interval ? size : prof->interval;
+}
+
+static GcProfileSite* gc_profile_site(GcProfile* prof, void** frames, int depth)
+{
+    size_t hash = 0;
+    for (int i = 0; i < depth; ++i) {
+        hash = hash * 31 + (((uintptr_t) frames[i]) >> 2);
+    }
+    size_t index = hash % GC_PROFILE_BUCKETS;
+    GcProfileSite* site = prof->sites[index];
+    while (site) {
+        if (site->depth == depth
+                && memcmp(site->frames, frames, depth * sizeof(void*)) == 0) {
+            return site;
+        }
+        site = site->next;
+    }
+    site = (GcProfileSite*) calloc(1, sizeof(GcProfileSite));
+    if (!site) return NULL;
+    site->depth = depth;
+    memcpy(site->frames, frames, depth * sizeof(void*));
+    site->next = prof->sites[index];
+    prof->sites[index] = site;
+    return site;
+}
+
+static void gc_profile_sample(GcProfile* prof, Allocation* alloc)
+{
+    if (alloc->size < prof->countdown) {
+        prof->countdown -= alloc->size;
+        return;
+    }
+    prof->countdown = prof->interval;
+    void* frames[GC_PROFILE_MAX_DEPTH];
+    int depth = backtrace(frames, GC_PROFILE_MAX_DEPTH);
+    GcProfileSite* site = gc_profile_site(prof, frames, depth);
+    if (site) {
+        size_t weight = gc_profile_weight(prof, alloc->size);
+        site->alloc_bytes += weight;
+        site->live_bytes += weight;
+        alloc->site = site;
+    }
+}
+
+static void gc_profile_release(GcProfile* prof, Allocation* alloc)
+{
+    if (prof && alloc->site) {
+        alloc->site->live_bytes -= gc_profile_weight(prof, alloc->size);
+        alloc->site = NULL;
+    }
+}
+
+void gc_profile_start(GarbageCollector* gc, size_t sample_interval)
+{
+    if (gc->profile) return;
+    GcProfile* prof = (GcProfile*) calloc(1, sizeof(GcProfile));
+    if (!prof) {
+        LOG_WARNING("Failed to allocate heap profile (errno=%d)", errno);
+        return;
+    }
+    prof->interval = sample_interval ? sample_interval : 1;
+    prof->countdown = prof->interval;
+    gc->profile = prof;
+}
+
+void gc_profile_stop(GarbageCollector* gc)
+{
+    GcProfile* prof = gc->profile;
+    if (!prof) return;
+    /* Detach sampled allocations from the sites we are about to delete */
+    for (size_t i = 0; i < gc->allocs->allocs.capacity; ++i) {
+        if (gc_slots_full(&gc->allocs->allocs, i)) {
+            gc->allocs->allocs.slots[i]->site = NULL;
+        }
+    }
+    for (size_t i = 0; i < GC_PROFILE_BUCKETS; ++i) {
+        GcProfileSite* site = prof->sites[i];
+        while (site) {
+            GcProfileSite* tmp = site;
+            site = site->next;
+            free(tmp);
+        }
+    }
+    free(prof);
+    gc->profile = NULL;
+}
+
+static bool gc_profile_is_entry_point(const char* name, size_t len)
+{
+    for (const char** e = gc_profile_entry_points; *e; ++e) {
+        if (strlen(*e) == len && strncmp(*e, name, len) == 0) return true;
+    }
+    return false;
+}
+
+/*
+ * Extracts the function name from a backtrace_symbols() entry, which looks
+ * like "binary(function+0x1f) [0x4011d6]". Returns the name length, or zero
+ * if the symbol could not be resolved.
+ */
+static size_t gc_profile_frame_name(const char* symbol, const char** name)
+{
+    const char* begin = strchr(symbol, '(');
+    if (!begin) return 0;
+    *name = ++begin;
+    return strcspn(begin, "+)");
+}
+
+static void gc_profile_write_site(FILE* out, GcProfileSite* site, size_t value)
+{
+    char** symbols = backtrace_symbols(site->frames, site->depth);
+    /* Strip the profiler and allocator frames at the inner end of the stack */
+    int inner = 0;
+    for (int i = 0; symbols && i < site->depth && i < GC_PROFILE_MAX_SKIP; ++i) {
+        const char* name;
+        size_t len = gc_profile_frame_name(symbols[i], &name);
+        if (len && gc_profile_is_entry_point(name, len)) inner = i + 1;
+    }
+    for (int i = site->depth - 1; i >= inner; --i) {
+        const char* name;
+        size_t len = symbols ? gc_profile_frame_name(symbols[i], &name) : 0;
+        if (len) {
+            fprintf(out, "%.*s", (int) len, name);
         } else {
-            // move on
-            prev = cur;
+            fprintf(out, "%p", site->frames[i]);
+        }
+        fputc(i > inner ? ';' : ' ', out);
+    }
+    fprintf(out, "%zu\n", value);
+    free(symbols);
+}
+
+size_t gc_profile_dump(GarbageCollector* gc, FILE* out, GcProfileMetric metric)
+{
+    GcProfile* prof = gc->profile;
+    if (!prof) return 0;
+    size_t lines = 0;
+    for (size_t i = 0; i < GC_PROFILE_BUCKETS; ++i) {
+        for (GcProfileSite* site = prof->sites[i]; site; site = site->next) {
+            size_t value = 0;
+            switch (metric) {
+            case GC_PROFILE_ALLOC_BYTES:
+                value = site->alloc_bytes;
+                break;
+            case GC_PROFILE_LIVE_BYTES:
+                value = site->live_bytes;
+                break;
+            case GC_PROFILE_SURVIVALS:
+                value = site->survivals;
+                break;
+            }
+            if (value) {
+                gc_profile_write_site(out, site, value);
+                lines++;
+            }
         }
-        cur = cur->next;
     }
-    double load_factor = gc_allocation_map_load_factor(am);
-    if (load_factor < am->downsize_factor) {
-        LOG_DEBUG("Load factor %0.3g < %0.3g. Triggering downsize.", load_factor, am->downsize_factor);
-        gc_allocation_map_resize(am, next_prime(am->capacity / 2));
+    return lines;
+}
+
+
+/*
+ * Allocation trace recorder, see gc.h for the format.
+ */
+typedef struct GcTrace {
+    FILE* out;
+    uint64_t last_id;         // id of the most recent traced allocation
+} GcTrace;
+
+static void gc_trace_varint(GcTrace* trace, uint64_t v)
+{
+    while (v >= 0x80) {
+        putc((int) (v & 0x7f) | 0x80, trace->out);
+        v >>= 7;
+    }
+    putc((int) v, trace->out);
+}
+
+static void gc_trace_alloc(GcTrace* trace, Allocation* alloc, size_t count,
+                           size_t size, Allocation* prev)
+{
+    if (prev) {
+        putc(GC_TRACE_REALLOC, trace->out);
+        gc_trace_varint(trace, prev->trace_id ? trace->last_id + 1 - prev->trace_id : 0);
+        gc_trace_varint(trace, size);
+    } else if (count) {
+        putc(GC_TRACE_CALLOC, trace->out);
+        gc_trace_varint(trace, count);
+        gc_trace_varint(trace, size);
+    } else {
+        putc(GC_TRACE_MALLOC, trace->out);
+        gc_trace_varint(trace, size);
+    }
+    alloc->trace_id = ++trace->last_id;
+}
+
+static void gc_trace_release(GcTrace* trace, Allocation* alloc, GcTraceEvent event)
+{
+    /* Allocations made before tracing started are not part of the trace */
+    if (trace && alloc->trace_id) {
+        putc(event, trace->out);
+        gc_trace_varint(trace, trace->last_id - alloc->trace_id);
+        alloc->trace_id = 0;
     }
 }
 
+bool gc_trace_start(GarbageCollector* gc, FILE* out)
+{
+    if (gc->trace) return false;
+    GcTrace* trace = (GcTrace*) calloc(1, sizeof(GcTrace));
+    if (!trace) return false;
+    trace->out = out;
+    fwrite(GC_TRACE_MAGIC, 1, strlen(GC_TRACE_MAGIC), out);
+    gc->trace = trace;
+    return true;
+}
 
-static void* gc_mcalloc(size_t count, size_t size)
+void gc_trace_stop(GarbageCollector* gc)
 {
+    GcTrace* trace = gc->trace;
+    if (!trace) return;
+    for (size_t i = 0; i < gc->allocs->allocs.capacity; ++i) {
+        if (gc_slots_full(&gc->allocs->allocs, i)) {
+            gc->allocs->allocs.slots[i]->trace_id = 0;
+        }
+    }
+    fflush(trace->out);
+    free(trace);
+    gc->trace = NULL;
+}
+
+
+/*
+ * Object memory comes from the collector's heap if it has one, and from the
+ * system allocator otherwise.
+ */
+static void* gc_mcalloc(GarbageCollector* gc, size_t count, size_t size)
+{
+    if (gc->heap) {
+        size_t alloc_size = count ? count * size : size;
+        void* ptr = heap_alloc(gc->heap, alloc_size);
+        if (ptr && count) {
+            memset(ptr, 0, alloc_size);
+        }
+        return ptr;
+    }
     if (!count) return malloc(size);
     return calloc(count, size);
 }
 
+static void* gc_mrealloc(GarbageCollector* gc, void* ptr, size_t old_size, size_t size)
+{
+    if (gc->heap) {
+        return heap_realloc(gc->heap, ptr, old_size, size);
+    }
+    return realloc(ptr, size);
+}
+
+static void gc_mfree(GarbageCollector* gc, void* ptr, size_t size)
+{
+    if (gc->heap) {
+        heap_free(gc->heap, ptr, size);
+    } else {
+        free(ptr);
+    }
+}
+
 
 static void* gc_allocate(GarbageCollector* gc, size_t count, size_t size, void(*dtor)(void*))
 {
     /* Allocation logic that generalizes over malloc/calloc. */
 
     /* Attempt to allocate memory */
-    void* ptr = gc_mcalloc(count, size);
+    void* ptr = gc_mcalloc(gc, count, size);
     size_t alloc_size = count ? count * size : size;
     /* If allocation fails, attempt to free some memory and try again. */
     if (!ptr && (errno == EAGAIN || errno == ENOMEM)) {
         gc_run(gc);
-        ptr = gc_mcalloc(count, size);
+        ptr = gc_mcalloc(gc, count, size);
     }
     /* Start managing the memory we received from the system */
     if (ptr) {
@@ -272,8 +626,19 @@ static void* gc_allocate(GarbageCollector* gc, size_t count, size_t size, void(*
         /* Deal with metadata allocation failure */
         if (alloc) {
             LOG_DEBUG("Managing %zu bytes at %p", alloc_size, (void*) alloc->ptr);
+            if (gc->profile) {
+                gc_profile_sample(gc->profile, alloc);
+            }
+            if (gc->trace) {
+                gc_trace_alloc(gc->trace, alloc, count, size, NULL);
+            }
             if (gc->allocs->size > gc->allocs->sweep_limit) {
+                /* The new allocation may only be referenced from a register
+                 * at this point, so keep it alive explicitly. */
+                char tag = alloc->tag;
+                alloc->tag |= GC_TAG_ROOT;
                 size_t freed_mem = gc_run(gc);
+                alloc->tag = tag;
                 LOG_DEBUG("Garbage collection cleaned up %lu bytes.", freed_mem);
             }
             ptr = alloc->ptr;
@@ -285,7 +650,8 @@ static void* gc_allocate(GarbageCollector* gc, size_t count, size_t size, void(*
             if (alloc) {
                 ptr = alloc->ptr;
             } else {
-                free(ptr);
+                gc_mfree(gc, ptr, alloc_size);
+                errno = ENOMEM;
                 ptr = NULL;
             }
         }
@@ -325,23 +691,47 @@ void* gc_realloc(GarbageCollector* gc, void* p, size_t size)
         errno = EINVAL;
         return NULL;
     }
-    void* q = realloc(p, size);
+    void* q = gc_mrealloc(gc, p, alloc ? alloc->size : 0, size);
     if (!q) {
         // realloc failed but p is still valid
         return NULL;
     }
     if (!p) {
         // allocation, not reallocation
-        Allocation* alloc = gc_allocation_map_put(gc->allocs, q, size, NULL);
-        return alloc->ptr;
-    }
-    if (p == q) {
-        // successful reallocation w/o copy
-        alloc->size = size;
+        alloc = gc_allocation_map_put(gc->allocs, q, size, NULL);
+        if (!alloc) {
+            gc_mfree(gc, q, size);
+            errno = ENOMEM;
+            return NULL;
+        }
+        if (gc->trace) {
+            gc_trace_alloc(gc->trace, alloc, 0, size, alloc);
+        }
     } else {
-        // successful reallocation w/ copy
-        gc_allocation_map_remove(gc->allocs, p);
-        gc_allocation_map_put(gc->allocs, p, size, alloc->dtor);
+        Allocation prev = *alloc;
+        gc_profile_release(gc->profile, alloc);
+        if (p == q) {
+            // successful reallocation w/o copy
+            alloc->size = size;
+        } else {
+            // successful reallocation w/ copy
+            gc_allocation_map_remove(gc->allocs, p);
+            alloc = gc_allocation_map_put(gc->allocs, q, size, prev.dtor);
+            if (!alloc) {
+                // p is gone and q cannot be tracked
+                gc_mfree(gc, q, size);
+                errno = ENOMEM;
+                return NULL;
+            }
+            alloc->tag = prev.tag;
+            alloc->roots = prev.roots;
+        }
+        if (gc->trace) {
+            gc_trace_alloc(gc->trace, alloc, 0, size, &prev);
+        }
+    }
+    if (gc->profile) {
+        gc_profile_sample(gc->profile, alloc);
     }
     return q;
 }
@@ -353,7 +743,9 @@ void gc_free(GarbageCollector* gc, void* ptr)
         if (alloc->dtor) {
             alloc->dtor(ptr);
         }
-        free(ptr);
+        gc_profile_release(gc->profile, alloc);
+        gc_trace_release(gc->trace, alloc, GC_TRACE_FREE);
+        gc_mfree(gc, ptr, alloc->size);
         gc_allocation_map_remove(gc->allocs, ptr);
     } else {
         LOG_WARNING("Ignoring request to free unknown pointer %p", (void*) ptr);
@@ -362,7 +754,7 @@ void gc_free(GarbageCollector* gc, void* ptr)
 
 void gc_start(GarbageCollector* gc, void* bos)
 {
-    gc_start_ext(gc, bos, 1024, 1024, 0.2, 0.8, 0.5);
+    gc_start_ext(gc, bos, 1024, 1024, 0.2, 0.8, 0.5, NULL);
 }
 
 void gc_start_ext(GarbageCollector* gc,
@@ -371,23 +763,36 @@ void gc_start_ext(GarbageCollector* gc,
                   size_t min_capacity,
                   double downsize_load_factor,
                   double upsize_load_factor,
-                  double sweep_factor)
+                  double sweep_factor,
+                  Heap* heap)
 {
     double downsize_limit = downsize_load_factor > 0.0 ? downsize_load_factor : 0.2;
     double upsize_limit = upsize_load_factor > 0.0 ? upsize_load_factor : 0.8;
     sweep_factor = sweep_factor > 0.0 ? sweep_factor : 0.5;
     gc->paused = false;
     gc->bos = bos;
+    gc->heap = heap;
+    gc->profile = NULL;
+    gc->trace = NULL;
+    memset(&gc->stats, 0, sizeof(GcStats));
+    gc->on_run = NULL;
     initial_capacity = initial_capacity < min_capacity ? min_capacity : initial_capacity;
-    gc->allocs = gc_allocation_map_new(min_capacity, initial_capacity,
+    Heap* meta = heap && (heap->flags & HEAP_FIXED) ? heap : NULL;
+    gc->allocs = gc_allocation_map_new(meta, min_capacity, initial_capacity,
                                        sweep_factor, downsize_limit, upsize_limit);
-    LOG_DEBUG("Created new garbage collector (cap=%ld, siz=%ld).", gc->allocs->capacity,
+    if (!gc->allocs) {
+        LOG_CRITICAL("Failed to allocate the allocation map (cap=%ld)", initial_capacity);
+        return;
+    }
+    LOG_DEBUG("Created new garbage collector (cap=%ld, siz=%ld).", gc->allocs->allocs.capacity,
               gc->allocs->size);
 }
 
 void gc_stop(GarbageCollector* gc)
 {
     gc_run(gc);
+    gc_trace_stop(gc);
+    gc_profile_stop(gc);
     gc_allocation_map_delete(gc->allocs);
     return;
 }
@@ -402,8 +807,37 @@ void gc_resume(GarbageCollector* gc)
     gc->paused = false;
 }
 
+void* gc_make_root(GarbageCollector* gc, void* ptr)
+{
+    Allocation* alloc = gc_allocation_map_get(gc->allocs, ptr);
+    if (!alloc) {
+        LOG_WARNING("Ignoring request to root unknown pointer %p", ptr);
+        return NULL;
+    }
+    alloc->roots++;
+    alloc->tag |= GC_TAG_ROOT;
+    return ptr;
+}
+
+/* Undoes one gc_make_root(), the allocation is a root until all are undone */
+void gc_unroot(GarbageCollector* gc, void* ptr)
+{
+    Allocation* alloc = gc_allocation_map_get(gc->allocs, ptr);
+    if (!alloc || alloc->roots == 0) {
+        LOG_WARNING("Ignoring request to unroot non-root pointer %p", ptr);
+        return;
+    }
+    if (--alloc->roots == 0) {
+        alloc->tag &= ~GC_TAG_ROOT;
+    }
+}
+
 void gc_mark_alloc(GarbageCollector* gc, void* ptr)
 {
+    /* Cheaply reject anything outside of the collector's heap */
+    if (gc->heap && !heap_contains(gc->heap, ptr)) {
+        return;
+    }
     Allocation* alloc = gc_allocation_map_get(gc->allocs, ptr);
     /* Mark if alloc exists and is not tagged already, otherwise skip */
     if (alloc && !(alloc->tag & GC_TAG_MARK)) {
@@ -441,14 +875,11 @@ void gc_mark_stack(GarbageCollector* gc)
 void gc_mark_roots(GarbageCollector* gc)
 {
     LOG_DEBUG("Marking roots%s", "");
-    for (size_t i = 0; i < gc->allocs->capacity; ++i) {
-        Allocation* chunk = gc->allocs->allocs[i];
-        while (chunk) {
-            if (chunk->tag & GC_TAG_ROOT) {
-                LOG_DEBUG("Marking root @ %p", chunk->ptr);
-                gc_mark_alloc(gc, chunk->ptr);
-            }
-            chunk = chunk->next;
+    AllocationSlots* allocs = &gc->allocs->allocs;
+    for (size_t i = 0; i < allocs->capacity; ++i) {
+        if (gc_slots_full(allocs, i) && (allocs->slots[i]->tag & GC_TAG_ROOT)) {
+            LOG_DEBUG("Marking root @ %p", allocs->slots[i]->ptr);
+            gc_mark_alloc(gc, allocs->slots[i]->ptr);
         }
     }
 }
@@ -471,37 +902,69 @@ size_t gc_sweep(GarbageCollector* gc)
 {
     LOG_DEBUG("Initiating GC sweep (gc@%p)", (void*) gc);
     size_t total = 0;
-    for (size_t i = 0; i < gc->allocs->capacity; ++i) {
-        Allocation* chunk = gc->allocs->allocs[i];
-        /* Iterate over separate chaining */
-        while (chunk) {
-            if (chunk->tag & GC_TAG_MARK) {
-                LOG_DEBUG("Found used allocation %p (ptr=%p)", (void*) chunk, (void*) chunk->ptr);
-                /* unmark */
-                chunk->tag &= ~GC_TAG_MARK;
-            } else {
-                LOG_DEBUG("Found unused allocation %p (ptr=%p)", (void*) chunk, (void*) chunk->ptr);
-                /* no reference to this chunk, hence delete it */
-                //total += 1;
-                total += chunk->size;
-                if (chunk->dtor) {
-                    chunk->dtor(chunk->ptr);
-                }
-                free(chunk->ptr);
-                /* and remove it from the bookkeeping */
-                gc_allocation_map_remove(gc->allocs, chunk->ptr);
+    AllocationMap* am = gc->allocs;
+    for (size_t i = 0; i < am->allocs.capacity; ++i) {
+        /* Erasing a slot moves no other entry, so the walk neither skips
+         * nor revisits any. The map is only resized once it is done. */
+        if (!gc_slots_full(&am->allocs, i)) {
+            continue;
+        }
+        Allocation* chunk = am->allocs.slots[i];
+        if (chunk->tag & GC_TAG_MARK) {
+            LOG_DEBUG("Found used allocation %p (ptr=%p)", (void*) chunk, (void*) chunk->ptr);
+            /* unmark */
+            chunk->tag &= ~GC_TAG_MARK;
+            if (chunk->site) {
+                chunk->site->survivals++;
+            }
+        } else {
+            LOG_DEBUG("Found unused allocation %p (ptr=%p)", (void*) chunk, (void*) chunk->ptr);
+            /* no reference to this chunk, hence delete it */
+            total += chunk->size;
+            if (chunk->dtor) {
+                chunk->dtor(chunk->ptr);
             }
-            chunk = chunk->next;
+            gc_profile_release(gc->profile, chunk);
+            gc_trace_release(gc->trace, chunk, GC_TRACE_SWEEP);
+            gc_mfree(gc, chunk->ptr, chunk->size);
+            /* and remove it from the bookkeeping */
+            gc_slots_erase(&am->allocs, i);
+            gc_allocation_delete(am->heap, chunk);
+            am->size--;
         }
     }
+    if (am->size < am->downsize_limit) {
+        LOG_DEBUG("Load factor %0.3g < %0.3g. Triggering downsize.",
+                  gc_allocation_map_load_factor(am), am->downsize_factor);
+        gc_allocation_map_resize(am, am->allocs.capacity / 2);
+    }
     return total;
 }
 
+static uint64_t gc_clock_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
 size_t gc_run(GarbageCollector* gc)
 {
     LOG_DEBUG("Initiating GC run (gc@%p)", (void*) gc);
+    uint64_t start = gc_clock_ns();
+    if (gc->trace) {
+        putc(GC_TRACE_RUN, gc->trace->out);
+    }
     gc_mark(gc);
-    return gc_sweep(gc);
+    size_t total = gc_sweep(gc);
+    gc->stats.last_pause_ns = gc_clock_ns() - start;
+    gc->stats.total_pause_ns += gc->stats.last_pause_ns;
+    gc->stats.collected += total;
+    gc->stats.runs++;
+    if (gc->on_run) {
+        gc->on_run(gc);
+    }
+    return total;
 }
 
 char* gc_strdup (GarbageCollector* gc, const char* s)
@@ -0,0 +1,415 @@
+/*
+ * hamt.c
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include <string.h>
+
+#include "gc.h"
+#include "hamt.h"
+#include "log.h"
+#include "value.h"
+
+#define HAMT_MASK ((1u << HAMT_BITS) - 1)
+
+/*
+ * A trie node. Entries are stored as key/value pairs in the order of their
+ * hash fragment, followed by the sub-nodes in the same order. Once a hash
+ * is used up, keys that still collide share a collision node, which holds
+ * its entries unordered.
+ */
+typedef struct HamtNode {
+    uint32_t datamap;         // fragments that hold an entry
+    uint32_t nodemap;         // fragments that hold a sub-node
+    uint32_t collisions;      // number of entries of a collision node, else 0
+    void* slots[];
+} HamtNode;
+
+static unsigned hamt_popcount(uint32_t x)
+{
+    return (unsigned) __builtin_popcount(x);
+}
+
+static uint32_t hamt_bit(uint64_t hash, unsigned shift)
+{
+    return 1u << ((hash >> shift) & HAMT_MASK);
+}
+
+static unsigned hamt_entries(const HamtNode* node)
+{
+    return node->collisions ? node->collisions : hamt_popcount(node->datamap);
+}
+
+static unsigned hamt_slots(const HamtNode* node)
+{
+    return 2 * hamt_entries(node) + hamt_popcount(node->nodemap);
+}
+
+static HamtNode* hamt_child(const HamtNode* node, unsigned i)
+{
+    return node->slots[2 * hamt_entries(node) + i];
+}
+
+/* A node that a parent should hold as a plain entry instead */
+static bool hamt_is_singleton(const HamtNode* node)
+{
+    return hamt_entries(node) == 1 && node->nodemap == 0;
+}
+
+static HamtNode* hamt_node_new(uint32_t datamap, uint32_t nodemap, uint32_t collisions,
+                               unsigned slots)
+{
+    HamtNode* node = gc_malloc(&gc, sizeof(HamtNode) + slots * sizeof(void*));
+    node->datamap = datamap;
+    node->nodemap = nodemap;
+    node->collisions = collisions;
+    return node;
+}
+
+static HamtNode* hamt_node_copy(const HamtNode* node)
+{
+    unsigned slots = hamt_slots(node);
+    HamtNode* copy = hamt_node_new(node->datamap, node->nodemap, node->collisions, slots);
+    memcpy(copy->slots, node->slots, slots * sizeof(void*));
+    return copy;
+}
+
+/* Builds the smallest sub-trie that holds two entries with different keys */
+static HamtNode* hamt_node_merge(Value* k1, uint64_t h1, Value* v1,
+                                 Value* k2, uint64_t h2, Value* v2, unsigned shift)
+{
+    if (shift >= 64) {
+        HamtNode* node = hamt_node_new(0, 0, 2, 4);
+        node->slots[0] = k1;
+        node->slots[1] = v1;
+        node->slots[2] = k2;
+        node->slots[3] = v2;
+        return node;
+    }
+    uint32_t b1 = hamt_bit(h1, shift);
+    uint32_t b2 = hamt_bit(h2, shift);
+    if (b1 == b2) {
+        HamtNode* node = hamt_node_new(0, b1, 0, 1);
+        node->slots[0] = hamt_node_merge(k1, h1, v1, k2, h2, v2, shift + HAMT_BITS);
+        return node;
+    }
+    HamtNode* node = hamt_node_new(b1 | b2, 0, 0, 4);
+    int first = b1 < b2 ? 0 : 2;
+    node->slots[first] = k1;
+    node->slots[first + 1] = v1;
+    node->slots[2 - first] = k2;
+    node->slots[3 - first] = v2;
+    return node;
+}
+
+static HamtNode* hamt_collision_assoc(const HamtNode* node, Value* key, Value* value,
+                                      bool* added)
+{
+    unsigned n = node->collisions;
+    for (unsigned i = 0; i < n; ++i) {
+        if (value_equal(node->slots[2 * i], key)) {
+            if (node->slots[2 * i + 1] == value) {
+                return (HamtNode*) node;
+            }
+            HamtNode* copy = hamt_node_copy(node);
+            copy->slots[2 * i + 1] = value;
+            return copy;
+        }
+    }
+    HamtNode* copy = hamt_node_new(0, 0, n + 1, 2 * (n + 1));
+    memcpy(copy->slots, node->slots, 2 * n * sizeof(void*));
+    copy->slots[2 * n] = key;
+    copy->slots[2 * n + 1] = value;
+    *added = true;
+    return copy;
+}
+
+static HamtNode* hamt_node_assoc(const HamtNode* node, Value* key, uint64_t hash,
+                                 unsigned shift, Value* value, bool* added)
+{
+    if (node->collisions) {
+        return hamt_collision_assoc(node, key, value, added);
+    }
+    uint32_t bit = hamt_bit(hash, shift);
+    unsigned entries = hamt_popcount(node->datamap);
+    unsigned children = hamt_popcount(node->nodemap);
+    if (node->datamap & bit) {
+        unsigned i = hamt_popcount(node->datamap & (bit - 1));
+        Value* k = node->slots[2 * i];
+        Value* v = node->slots[2 * i + 1];
+        if (value_equal(k, key)) {
+            if (v == value) {
+                return (HamtNode*) node;
+            }
+            HamtNode* copy = hamt_node_copy(node);
+            copy->slots[2 * i + 1] = value;
+            return copy;
+        }
+        // both entries move down into a new sub-node
+        HamtNode* sub = hamt_node_merge(k, value_hash(k), v, key, hash, value,
+                                        shift + HAMT_BITS);
+        unsigned c = hamt_popcount(node->nodemap & (bit - 1));
+        HamtNode* copy = hamt_node_new(node->datamap ^ bit, node->nodemap | bit, 0,
+                                       2 * (entries - 1) + children + 1);
+        void** src = (void**) node->slots;
+        void** dst = copy->slots;
+        memcpy(dst, src, 2 * i * sizeof(void*));
+        memcpy(dst + 2 * i, src + 2 * i + 2, (2 * entries - 2 * i - 2 + c) * sizeof(void*));
+        dst[2 * entries - 2 + c] = sub;
+        memcpy(dst + 2 * entries - 1 + c, src + 2 * entries + c,
+               (children - c) * sizeof(void*));
+        *added = true;
+        return copy;
+    }
+    if (node->nodemap & bit) {
+        unsigned c = hamt_popcount(node->nodemap & (bit - 1));
+        HamtNode* child = hamt_child(node, c);
+        HamtNode* updated = hamt_node_assoc(child, key, hash, shift + HAMT_BITS, value, added);
+        if (updated == child) {
+            return (HamtNode*) node;
+        }
+        HamtNode* copy = hamt_node_copy(node);
+        copy->slots[2 * entries + c] = updated;
+        return copy;
+    }
+    unsigned i = hamt_popcount(node->datamap & (bit - 1));
+    HamtNode* copy = hamt_node_new(node->datamap | bit, node->nodemap, 0,
+                                   2 * entries + children + 2);
+    memcpy(copy->slots, node->slots, 2 * i * sizeof(void*));
+    copy->slots[2 * i] = key;
+    copy->slots[2 * i + 1] = value;
+    memcpy(copy->slots + 2 * i + 2, node->slots + 2 * i,
+           (2 * entries - 2 * i + children) * sizeof(void*));
+    *added = true;
+    return copy;
+}
+
+static HamtNode* hamt_collision_dissoc(const HamtNode* node, Value* key, bool* removed)
+{
+    unsigned n = node->collisions;
+    for (unsigned i = 0; i < n; ++i) {
+        if (value_equal(node->slots[2 * i], key)) {
+            HamtNode* copy = hamt_node_new(0, 0, n - 1, 2 * (n - 1));
+            memcpy(copy->slots, node->slots, 2 * i * sizeof(void*));
+            memcpy(copy->slots + 2 * i, node->slots + 2 * i + 2,
+                   2 * (n - i - 1) * sizeof(void*));
+            *removed = true;
+            return copy;
+        }
+    }
+    return (HamtNode*) node;
+}
+
+static HamtNode* hamt_node_dissoc(const HamtNode* node, Value* key, uint64_t hash,
+                                  unsigned shift, bool* removed)
+{
+    if (node->collisions) {
+        return hamt_collision_dissoc(node, key, removed);
+    }
+    uint32_t bit = hamt_bit(hash, shift);
+    unsigned entries = hamt_popcount(node->datamap);
+    unsigned children = hamt_popcount(node->nodemap);
+    if (node->datamap & bit) {
+        unsigned i = hamt_popcount(node->datamap & (bit - 1));
+        if (!value_equal(node->slots[2 * i], key)) {
+            return (HamtNode*) node;
+        }
+        HamtNode* copy = hamt_node_new(node->datamap ^ bit, node->nodemap, 0,
+                                       2 * (entries - 1) + children);
+        memcpy(copy->slots, node->slots, 2 * i * sizeof(void*));
+        memcpy(copy->slots + 2 * i, node->slots + 2 * i + 2,
+               (2 * entries - 2 * i - 2 + children) * sizeof(void*));
+        *removed = true;
+        return copy;
+    }
+    if (node->nodemap & bit) {
+        unsigned c = hamt_popcount(node->nodemap & (bit - 1));
+        HamtNode* child = hamt_child(node, c);
+        HamtNode* updated = hamt_node_dissoc(child, key, hash, shift + HAMT_BITS, removed);
+        if (updated == child) {
+            return (HamtNode*) node;
+        }
+        if (!hamt_is_singleton(updated)) {
+            HamtNode* copy = hamt_node_copy(node);
+            copy->slots[2 * entries + c] = updated;
+            return copy;
+        }
+        // the last entry of the sub-node moves up into this node
+        unsigned i = hamt_popcount(node->datamap & (bit - 1));
+        HamtNode* copy = hamt_node_new(node->datamap | bit, node->nodemap ^ bit, 0,
+                                       2 * (entries + 1) + children - 1);
+        void** src = (void**) node->slots;
+        void** dst = copy->slots;
+        memcpy(dst, src, 2 * i * sizeof(void*));
+        dst[2 * i] = updated->slots[0];
+        dst[2 * i + 1] = updated->slots[1];
+        memcpy(dst + 2 * i + 2, src + 2 * i, (2 * entries - 2 * i + c) * sizeof(void*));
+        memcpy(dst + 2 * entries + 2 + c, src + 2 * entries + c + 1,
+               (children - c - 1) * sizeof(void*));
+        return copy;
+    }
+    return (HamtNode*) node;
+}
+
+static Hamt* hamt_wrap(HamtNode* root, size_t size)
+{
+    Hamt* hamt = gc_malloc(&gc, sizeof(Hamt));
+    hamt->root = root;
+    hamt->size = size;
+    return hamt;
+}
+
+Hamt* hamt_new()
+{
+    return hamt_wrap(hamt_node_new(0, 0, 0, 0), 0);
+}
+
+/*
+ * The slot that holds the value of a key, or NULL. Nodes never change once
+ * built, so the slot keeps its value for as long as anyone refers to it.
+ */
+Value** hamt_get_cell(const Hamt* hamt, Value* key)
+{
+    uint64_t hash = value_hash(key);
+    HamtNode* node = hamt->root;
+    for (unsigned shift = 0; ; shift += HAMT_BITS) {
+        if (node->collisions) {
+            for (unsigned i = 0; i < node->collisions; ++i) {
+                if (value_equal(node->slots[2 * i], key)) {
+                    return (Value**) &node->slots[2 * i + 1];
+                }
+            }
+            return NULL;
+        }
+        uint32_t bit = hamt_bit(hash, shift);
+        if (node->datamap & bit) {
+            unsigned i = hamt_popcount(node->datamap & (bit - 1));
+            return value_equal(node->slots[2 * i], key) ? (Value**) &node->slots[2 * i + 1] : NULL;
+        }
+        if (!(node->nodemap & bit)) {
+            return NULL;
+        }
+        node = hamt_child(node, hamt_popcount(node->nodemap & (bit - 1)));
+    }
+}
+
+Value* hamt_get(const Hamt* hamt, Value* key)
+{
+    Value** cell = hamt_get_cell(hamt, key);
+    return cell ? *cell : NULL;
+}
+
+Hamt* hamt_assoc(const Hamt* hamt, Value* key, Value* value)
+{
+    bool added = false;
+    HamtNode* root = hamt_node_assoc(hamt->root, key, value_hash(key), 0, value, &added);
+    if (root == hamt->root) {
+        return (Hamt*) hamt;
+    }
+    return hamt_wrap(root, hamt->size + added);
+}
+
+Hamt* hamt_dissoc(const Hamt* hamt, Value* key)
+{
+    bool removed = false;
+    HamtNode* root = hamt_node_dissoc(hamt->root, key, value_hash(key), 0, &removed);
+    if (root == hamt->root) {
+        return (Hamt*) hamt;
+    }
+    return hamt_wrap(root, hamt->size - removed);
+}
+
+size_t hamt_size(const Hamt* hamt)
+{
+    return hamt->size;
+}
+
+static bool hamt_collision_contains(const HamtNode* node, Value* key, Value* value)
+{
+    for (unsigned i = 0; i < node->collisions; ++i) {
+        if (value_equal(node->slots[2 * i], key)) {
+            return value_equal(node->slots[2 * i + 1], value);
+        }
+    }
+    return false;
+}
+
+static bool hamt_node_equal(const HamtNode* a, const HamtNode* b)
+{
+    // shared nodes are equal without looking inside
+    if (a == b) {
+        return true;
+    }
+    if (a->datamap != b->datamap || a->nodemap != b->nodemap
+            || a->collisions != b->collisions) {
+        return false;
+    }
+    unsigned entries = hamt_entries(a);
+    for (unsigned i = 0; i < entries; ++i) {
+        if (a->collisions) {
+            if (!hamt_collision_contains(b, a->slots[2 * i], a->slots[2 * i + 1])) {
+                return false;
+            }
+        } else if (!value_equal(a->slots[2 * i], b->slots[2 * i])
+                   || !value_equal(a->slots[2 * i + 1], b->slots[2 * i + 1])) {
+            return false;
+        }
+    }
+    unsigned children = hamt_popcount(a->nodemap);
+    for (unsigned i = 0; i < children; ++i) {
+        if (!hamt_node_equal(hamt_child(a, i), hamt_child(b, i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool hamt_equal(const Hamt* a, const Hamt* b)
+{
+    return a == b || (a->size == b->size && hamt_node_equal(a->root, b->root));
+}
+
+uint64_t hamt_hash(const Hamt* hamt)
+{
+    // independent of the order of entries
+    uint64_t hash = hamt->size;
+    HamtIter it;
+    Value* key;
+    Value* value;
+    hamt_iter_init(&it, hamt);
+    while (hamt_iter_next(&it, &key, &value)) {
+        hash += value_hash(key) ^ (value_hash(value) * 0x9e3779b97f4a7c15ULL);
+    }
+    return hash;
+}
+
+void hamt_iter_init(HamtIter* it, const Hamt* hamt)
+{
+    it->depth = 0;
+    it->nodes[0] = hamt->root;
+    it->pos[0] = 0;
+}
+
+bool hamt_iter_next(HamtIter* it, Value** key, Value** value)
+{
+    while (it->depth >= 0) {
+        HamtNode* node = it->nodes[it->depth];
+        unsigned pos = it->pos[it->depth]++;
+        unsigned entries = hamt_entries(node);
+        if (pos < entries) {
+            *key = node->slots[2 * pos];
+            *value = node->slots[2 * pos + 1];
+            return true;
+        }
+        if (pos < entries + hamt_popcount(node->nodemap)) {
+            it->depth++;
+            it->nodes[it->depth] = hamt_child(node, pos - entries);
+            it->pos[it->depth] = 0;
+        } else {
+            it->depth--;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,108 @@
+/*
+ * hash.c
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include <string.h>
+
+#include "djb2.h"
+#include "hash.h"
+
+static const uint64_t hash_secret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+    0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+/* Folds the 128 bit product of a and b into 64 bits */
+static inline uint64_t hash_mix(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t) a * b;
+    return (uint64_t) r ^ (uint64_t) (r >> 64);
+#else
+    uint64_t ha = a >> 32, la = (uint32_t) a, hb = b >> 32, lb = (uint32_t) b;
+    uint64_t hh = ha * hb, hl = ha * lb, lh = la * hb, ll = la * lb;
+    uint64_t t = ll + (hl << 32);
+    uint64_t lo = t + (lh << 32);
+    uint64_t hi = hh + (hl >> 32) + (lh >> 32) + (t < ll) + (lo < t);
+    return lo ^ hi;
+#endif
+}
+
+/* Unaligned little-endian reads, memcpy compiles to a single load */
+static inline uint64_t hash_read8(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint64_t hash_read4(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+uint64_t hash_bytes(const void* data, size_t len, uint64_t seed)
+{
+    const uint8_t* p = (const uint8_t*) data;
+    uint64_t a, b;
+    seed ^= hash_mix(seed ^ hash_secret[0], hash_secret[1]);
+    if (len <= 16) {
+        if (len >= 4) {
+            /* two overlapping 4 byte reads from either end cover 4..16 bytes */
+            size_t mid = (len >> 3) << 2;
+            a = (hash_read4(p) << 32) | hash_read4(p + mid);
+            b = (hash_read4(p + len - 4) << 32) | hash_read4(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            /* three independent lanes keep the multipliers busy */
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = hash_mix(hash_read8(p) ^ hash_secret[1], hash_read8(p + 8) ^ seed);
+                see1 = hash_mix(hash_read8(p + 16) ^ hash_secret[2], hash_read8(p + 24) ^ see1);
+                see2 = hash_mix(hash_read8(p + 32) ^ hash_secret[3], hash_read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = hash_mix(hash_read8(p) ^ hash_secret[1], hash_read8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        /* the last 16 bytes, which may overlap bytes already consumed */
+        a = hash_read8(p + i - 16);
+        b = hash_read8(p + i - 8);
+    }
+    return hash_mix(hash_secret[1] ^ len, hash_mix(a ^ hash_secret[1], b ^ seed));
+}
+
+uint64_t hash_string(const char* str, size_t len)
+{
+#ifdef HASH_DJB2
+    /* djb2 keeps similar names close together in its low bits, which hash
+     * tables index by. A multiplicative mix spreads them out. */
+    uint64_t hash = (uint64_t) djb2_len(str, len) * 0x9e3779b97f4a7c15ULL;
+    return hash ^ (hash >> 32);
+#else
+    return hash_bytes(str, len, HASH_SEED);
+#endif
+}
@@ -0,0 +1,277 @@
+/*
+ * heap.c
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "heap.h"
+#include "log.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Set log level for this compilation unit.
+ */
+#undef LOGLEVEL
+#define LOGLEVEL LOGLEVEL_INFO
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+#define HEAP_MAX_NUMA_NODES 1024
+#define HEAP_SMALL_CLASSES (HEAP_SMALL_MAX / HEAP_ALIGN)
+
+/* A free small or medium chunk, linked into the free list of its class */
+typedef struct HeapChunk {
+    struct HeapChunk* next;
+} HeapChunk;
+
+/* A free large block */
+typedef struct HeapSpan {
+    size_t size;
+    struct HeapSpan* next;
+} HeapSpan;
+
+static size_t heap_round_up(size_t n, size_t to)
+{
+    return (n + to - 1) / to * to;
+}
+
+static size_t heap_class(size_t size)
+{
+    if (size <= HEAP_SMALL_MAX) {
+        return size ? (size - 1) / HEAP_ALIGN : 0;
+    }
+    size_t c = HEAP_SMALL_CLASSES;
+    for (size_t s = 2 * HEAP_SMALL_MAX; s < size; s <<= 1) {
+        c++;
+    }
+    return c;
+}
+
+static size_t heap_class_size(size_t c)
+{
+    if (c < HEAP_SMALL_CLASSES) {
+        return (c + 1) * HEAP_ALIGN;
+    }
+    return (size_t) HEAP_SMALL_MAX << (c - HEAP_SMALL_CLASSES + 1);
+}
+
+size_t heap_chunk_size(size_t size)
+{
+    if (size > HEAP_MEDIUM_MAX) {
+        return heap_round_up(size, HEAP_PAGE);
+    }
+    return heap_class_size(heap_class(size));
+}
+
+static int heap_bind(char* base, size_t size, int numa_node)
+{
+#ifdef __linux__
+    if (numa_node < 0 || numa_node >= HEAP_MAX_NUMA_NODES) {
+        errno = EINVAL;
+        return -1;
+    }
+    unsigned long mask[HEAP_MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = { 0 };
+    size_t bits = 8 * sizeof(unsigned long);
+    mask[numa_node / bits] |= 1UL << (numa_node % bits);
+    return (int) syscall(SYS_mbind, base, size, MPOL_BIND, mask,
+                         HEAP_MAX_NUMA_NODES + 1, 0);
+#else
+    (void) base;
+    (void) size;
+    (void) numa_node;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+Heap* heap_new(size_t size, int flags, int numa_node)
+{
+    size_t align = (flags & HEAP_HUGE_PAGES) ? HEAP_HUGE_PAGE : HEAP_PAGE;
+    size = heap_round_up(size, align);
+    /* Over-reserve so that the range can be aligned to a huge page */
+    size_t reserve = size + align - HEAP_PAGE;
+    char* p = mmap(NULL, reserve, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        LOG_WARNING("Failed to reserve %zu bytes of heap (errno=%d)", size, errno);
+        return NULL;
+    }
+    char* base = (char*) heap_round_up((uintptr_t) p, align);
+    if (base > p) {
+        munmap(p, base - p);
+    }
+    if (p + reserve > base + size) {
+        munmap(base + size, p + reserve - (base + size));
+    }
+#ifdef MADV_HUGEPAGE
+    if ((flags & HEAP_HUGE_PAGES) && madvise(base, size, MADV_HUGEPAGE) != 0) {
+        LOG_WARNING("Transparent huge pages unavailable (errno=%d)", errno);
+    }
+#endif
+    if ((flags & HEAP_NUMA_BIND) && heap_bind(base, size, numa_node) != 0) {
+        LOG_WARNING("Failed to bind heap to NUMA node %d (errno=%d)", numa_node, errno);
+    }
+    Heap* heap = (Heap*) calloc(1, sizeof(Heap));
+    if (!heap) {
+        munmap(base, size);
+        return NULL;
+    }
+    heap->base = heap->top = base;
+    heap->limit = base + size;
+    heap->flags = flags & ~HEAP_FIXED;
+    LOG_DEBUG("Reserved heap of %zu bytes at %p", size, (void*) base);
+    return heap;
+}
+
+Heap* heap_new_static(void* block, size_t size)
+{
+    /* The heap descriptor lives at the start of the block itself */
+    char* start = (char*) heap_round_up((uintptr_t) block, HEAP_ALIGN);
+    char* base = (char*) heap_round_up((uintptr_t) start + sizeof(Heap), HEAP_ALIGN);
+    if (!block || base > (char*) block + size) {
+        errno = EINVAL;
+        return NULL;
+    }
+    Heap* heap = (Heap*) start;
+    memset(heap, 0, sizeof(Heap));
+    heap->base = heap->top = base;
+    heap->limit = base + ((char*) block + size - base) / HEAP_ALIGN * HEAP_ALIGN;
+    heap->flags = HEAP_FIXED;
+    LOG_DEBUG("Fixed heap of %zu bytes at %p", (size_t) (heap->limit - base), (void*) base);
+    return heap;
+}
+
+void heap_delete(Heap* heap)
+{
+    if (heap->flags & HEAP_FIXED) {
+        /* Nothing to release, the block belongs to the caller */
+        return;
+    }
+    munmap(heap->base, heap->limit - heap->base);
+    free(heap);
+}
+
+static void* heap_bump(Heap* heap, size_t size)
+{
+    if ((size_t) (heap->limit - heap->top) < size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void* ptr = heap->top;
+    heap->top += size;
+    return ptr;
+}
+
+static void* heap_alloc_large(Heap* heap, size_t size)
+{
+    /* First fit from the free spans, splitting off the remainder */
+    HeapSpan** link = &heap->spans;
+    for (HeapSpan* span = *link; span; link = &span->next, span = *link) {
+        if (span->size < size) continue;
+        if (span->size > size) {
+            HeapSpan* rest = (HeapSpan*) ((char*) span + size);
+            rest->size = span->size - size;
+            rest->next = span->next;
+            *link = rest;
+        } else {
+            *link = span->next;
+        }
+        return span;
+    }
+    return heap_bump(heap, size);
+}
+
+static void heap_free_large(Heap* heap, char* ptr, size_t size)
+{
+    /* Insert into the address-ordered list of free spans */
+    HeapSpan** link = &heap->spans;
+    HeapSpan* prev = NULL;
+    while (*link && (char*) *link < ptr) {
+        prev = *link;
+        link = &prev->next;
+    }
+    HeapSpan* span = (HeapSpan*) ptr;
+    span->size = size;
+    span->next = *link;
+    *link = span;
+    /* Coalesce with the following and the preceding span */
+    if (span->next && ptr + span->size == (char*) span->next) {
+        span->size += span->next->size;
+        span->next = span->next->next;
+    }
+    if (prev && (char*) prev + prev->size == ptr) {
+        prev->size += span->size;
+        prev->next = span->next;
+        span = prev;
+    }
+    /* A span that ends at the bump pointer goes back to the bump region */
+    if ((char*) span + span->size == heap->top) {
+        heap->top = (char*) span;
+        for (link = &heap->spans; *link != span; link = &(*link)->next);
+        *link = NULL;
+    }
+}
+
+void* heap_alloc(Heap* heap, size_t size)
+{
+    size_t chunk_size = heap_chunk_size(size);
+    void* ptr;
+    if (size > HEAP_MEDIUM_MAX) {
+        ptr = heap_alloc_large(heap, chunk_size);
+    } else {
+        size_t c = heap_class(size);
+        HeapChunk* chunk = heap->free[c];
+        if (chunk) {
+            heap->free[c] = chunk->next;
+            ptr = chunk;
+        } else {
+            ptr = heap_bump(heap, chunk_size);
+        }
+    }
+    if (ptr) {
+        heap->used += chunk_size;
+    }
+    return ptr;
+}
+
+void* heap_realloc(Heap* heap, void* ptr, size_t old_size, size_t size)
+{
+    if (!ptr) {
+        return heap_alloc(heap, size);
+    }
+    if (heap_chunk_size(old_size) == heap_chunk_size(size)) {
+        return ptr;
+    }
+    void* q = heap_alloc(heap, size);
+    if (q) {
+        memcpy(q, ptr, old_size < size ? old_size : size);
+        heap_free(heap, ptr, old_size);
+    }
+    return q;
+}
+
+void heap_free(Heap* heap, void* ptr, size_t size)
+{
+    if (!ptr) return;
+    size_t chunk_size = heap_chunk_size(size);
+    heap->used -= chunk_size;
+    if (size > HEAP_MEDIUM_MAX) {
+        heap_free_large(heap, ptr, chunk_size);
+    } else {
+        size_t c = heap_class(size);
+        HeapChunk* chunk = (HeapChunk*) ptr;
+        chunk->next = heap->free[c];
+        heap->free[c] = chunk;
+    }
+}
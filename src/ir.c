@@ -8,6 +8,12 @@
 #include "ir.h"
 #include "log.h"
 
+/* The variables of a let or lambda, in the order of their slots */
+typedef struct IrScope {
+    List* names;
+    struct IrScope* parent;
+} IrScope;
+
 Value* ir_from_ast(AstSexpr* ast)
 {
     return ir_from_ast_sexpr(ast);
@@ -27,7 +33,11 @@ Value* ir_from_ast_atom(AstAtom* atom)
         v = value_new_string(atom->value.string);
         break;
     case ATOM_SYMBOL:
-        v = value_new_symbol(atom->value.string);
+        if (strcmp(atom->value.string, "true") == 0 || strcmp(atom->value.string, "false") == 0) {
+            v = value_new_bool(atom->value.string[0] == 't');
+        } else {
+            v = value_new_symbol(atom->value.string);
+        }
         break;
     default:
         LOG_CRITICAL("Unknown AST atom type: %d", atom->type);
@@ -44,7 +54,7 @@ Value* ir_from_ast_list(AstList* ast_list)
     }
     Value* sexpr = ir_from_ast_sexpr(ast_list->ast.compound.sexpr);
     Value* list = ir_from_ast_list(ast_list->ast.compound.list);
-    list_prepend(list->value.list, sexpr, sizeof(Value));
+    list_prepend(list->value.list, sexpr);
     return list;
 }
 
@@ -65,10 +75,146 @@ Value* ir_from_ast_sexpr(AstSexpr* ast)
         result = value_new_list();
         sexpr = ir_from_ast_sexpr(ast->ast.quoted);
         quote = value_new_string("quote");
-        list_append(result->value.list, quote, sizeof(Value));
-        list_append(result->value.list, sexpr, sizeof(Value));
+        list_append(result->value.list, quote);
+        list_append(result->value.list, sexpr);
         break;
     }
     return result;
 }
 
+
+/* Whether the expression is a list that starts with the given symbol */
+static bool ir_is_form(Value* expr, const char* name)
+{
+    if (value_type(expr) != VALUE_LIST) return false;
+    Value* head = list_head(expr->value.list);
+    return head && value_type(head) == VALUE_SYMBOL
+           && head->value.symbol == symbol_intern((char*) name);
+}
+
+static bool ir_resolve_in(Value* expr, IrScope* scope);
+
+static bool ir_resolve_all(List* exprs, IrScope* scope)
+{
+    Value* head;
+    while ((head = list_head(exprs)) != NULL) {
+        if (!ir_resolve_in(head, scope)) return false;
+        exprs = list_tail(exprs);
+    }
+    return true;
+}
+
+/* Checks that all names are symbols */
+static bool ir_check_names(List* names, const char* form)
+{
+    Value* head;
+    while ((head = list_head(names)) != NULL) {
+        if (value_type(head) != VALUE_SYMBOL) {
+            LOG_CRITICAL("%s binds a non-symbol of type %d", form, value_type(head));
+            return false;
+        }
+        names = list_tail(names);
+    }
+    return true;
+}
+
+/* (let (name init ...) body ...), the inits see the enclosing scope only */
+static bool ir_resolve_let(Value* expr, IrScope* scope)
+{
+    List* rest = list_tail(expr->value.list);
+    Value* bindings = list_head(rest);
+    if (!bindings || value_type(bindings) != VALUE_LIST || list_size(bindings->value.list) % 2) {
+        LOG_CRITICAL("let requires a list of name and value pairs%s", "");
+        return false;
+    }
+    List* names = list_new();
+    List* pairs = bindings->value.list;
+    Value* name;
+    while ((name = list_head(pairs)) != NULL) {
+        pairs = list_tail(pairs);
+        list_append(names, name);
+        if (!ir_resolve_in(list_head(pairs), scope)) return false;
+        pairs = list_tail(pairs);
+    }
+    if (!ir_check_names(names, "let")) return false;
+    IrScope inner = { names, scope };
+    return ir_resolve_all(list_tail(rest), &inner);
+}
+
+/* (lambda (name ...) body ...) */
+static bool ir_resolve_lambda(Value* expr, IrScope* scope)
+{
+    List* rest = list_tail(expr->value.list);
+    Value* params = list_head(rest);
+    if (!params || value_type(params) != VALUE_LIST) {
+        LOG_CRITICAL("lambda requires a parameter list%s", "");
+        return false;
+    }
+    if (!ir_check_names(params->value.list, "lambda")) return false;
+    IrScope inner = { params->value.list, scope };
+    return ir_resolve_all(list_tail(rest), &inner);
+}
+
+/*
+ * Rewrites the symbols bound by an enclosing let or lambda into locals
+ * that name the frame and the slot they live in, in place. Other symbols
+ * become globals, which are looked up by name.
+ */
+static bool ir_resolve_in(Value* expr, IrScope* scope)
+{
+    if (!expr) return false;
+    if (value_type(expr) == VALUE_SYMBOL) {
+        unsigned depth = 0;
+        for (IrScope* s = scope; s; s = s->parent, ++depth) {
+            unsigned slot = 0;
+            Value* name;
+            // the last binding of a name wins
+            int found = -1;
+            for (List* names = s->names; (name = list_head(names)) != NULL;
+                    names = list_tail(names), ++slot) {
+                if (name->value.symbol == expr->value.symbol) {
+                    found = (int) slot;
+                }
+            }
+            if (found >= 0) {
+                Symbol* symbol = expr->value.symbol;
+                expr->type = VALUE_LOCAL;
+                expr->value.local.depth = depth;
+                expr->value.local.slot = (unsigned) found;
+                expr->value.local.symbol = symbol;
+                return true;
+            }
+        }
+        // free, eval() caches the cell it finds for it
+        Symbol* symbol = expr->value.symbol;
+        expr->type = VALUE_GLOBAL;
+        expr->value.global.symbol = symbol;
+        expr->value.global.cell = NULL;
+        expr->value.global.env = NULL;
+        expr->value.global.version = 0;
+        return true;
+    }
+    if (value_type(expr) != VALUE_LIST) {
+        return true;
+    }
+    if (ir_is_form(expr, "let")) {
+        return ir_resolve_let(expr, scope);
+    }
+    if (ir_is_form(expr, "lambda")) {
+        return ir_resolve_lambda(expr, scope);
+    }
+    return ir_resolve_all(expr->value.list, scope);
+}
+
+/*
+ * Lexical addressing. Resolves every variable of a let or lambda to the
+ * number of frames between its use and its binding and to its slot in
+ * that frame, so that eval() finds it with a few pointer hops instead of
+ * hashing its name. All other variables turn into globals that remember
+ * the cell of their binding. Returns the expression, or NULL if a let or
+ * lambda is malformed.
+ */
+Value* ir_resolve(Value* expr)
+{
+    return ir_resolve_in(expr, NULL) ? expr : NULL;
+}
@@ -13,7 +13,7 @@
 
 
 typedef struct ListItem {
-    char* p;
+    void* p;
     struct ListItem* prev;
     struct ListItem* next;
 } ListItem;
@@ -33,7 +33,6 @@ void list_delete(List* l)
         ListItem* i = l->begin;
         ListItem* j;
         while(i != l->end) {
-            gc_free(&gc, i->p); // free the payload
             j = i->next; // save the ptr to next
             gc_free(&gc, i); // free current
             i = j; // move on
@@ -42,17 +41,16 @@ void list_delete(List* l)
     gc_free(&gc, l);
 }
 
-static ListItem* list_new_item(void* value, size_t size)
+static ListItem* list_new_item(void* value)
 {
     ListItem* item = (ListItem*) gc_malloc(&gc, sizeof(ListItem));
-    item->p = (char *) gc_malloc(&gc, size);
-    memcpy(item->p, value, size);
+    item->p = value;
     return item;
 }
 
-void list_append(List* l, void* value, size_t size)
+void list_append(List* l, void* value)
 {
-    ListItem* item = list_new_item(value, size);
+    ListItem* item = list_new_item(value);
     if (l->size > 0) {
         l->end->next = item;
         item->prev = l->end;
@@ -67,9 +65,9 @@ void list_append(List* l, void* value, size_t size)
     }
 }
 
-void list_prepend(List* l, void* value, size_t size)
+void list_prepend(List* l, void* value)
 {
-    ListItem* item = list_new_item(value, size);
+    ListItem* item = list_new_item(value);
     if (l->size > 0) {
         item->next = l->begin;
         l->begin->prev = item;
@@ -86,7 +84,7 @@ void list_prepend(List* l, void* value, size_t size)
 
 void* list_head(List* l)
 {
-    return l->begin ? (void*) l->begin->p : NULL;
+    return l->begin ? l->begin->p : NULL;
 }
 
 static ListItem* list_copy_item(ListItem* item)
@@ -22,6 +22,7 @@
 #include "list.h"
 #include "log.h"
 #include "reader.h"
+#include "symbol.h"
 #include "value.h"
 
 Value* read_(char* input) {
@@ -51,16 +52,21 @@ int main(int argc, char* argv[])
     printf("Stutter version %s\n\n", __STUTTER_VERSION__);
 
     // set up garbage collection
-    gc_start(&gc, &bos, 0.0, 0.0, 0.6);
-    // create env
-    Environment* env = env_new(NULL);
-    Value* sum = value_new_fn(core_sum);
-    printf("Setup: ");
-    value_print(sum);
-    printf("\n");
-    env_set(env, "sum", sum); // FIXME
+    gc_start_ext(&gc, &bos, 1024, 1024, 0.0, 0.0, 0.6, NULL);
+    // optionally record an allocation trace for bench/gc_replay
+    FILE* trace = NULL;
+    char* trace_path = getenv("STUTTER_GC_TRACE");
+    if (trace_path) {
+        if ((trace = fopen(trace_path, "wb"))) {
+            gc_trace_start(&gc, trace);
+        } else {
+            printf("%s: %s\n", trace_path, strerror(errno));
+        }
+    }
+    // create env, user definitions go on top of the frozen builtins
+    Environment* env = env_new(core_env_new());
     printf("Setup test: ");
-    value_print(env_get(env, "sum"));
+    value_print(env_get(env, symbol_intern("sum")));
     printf("\n");
 
     while(1) {
@@ -69,14 +75,18 @@ int main(int argc, char* argv[])
             break;
         }
         add_history(input);
-        Value* eval_result = eval(read_(input), env);
+        Value* eval_result = eval(ir_resolve(read_(input)), env);
         value_print(eval_result);
-        value_delete(eval_result);
+        // results may be shared with maps and environments, the GC frees them
         printf("\n");
         free(input);
     }
+    env_delete(env->parent);
     env_delete(env);
     gc_stop(&gc);
+    if (trace) {
+        fclose(trace);
+    }
     return 0;
 }
 
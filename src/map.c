@@ -5,175 +5,454 @@
  * Distributed under terms of the MIT license.
  */
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 
-#include "djb2.h"
 #include "gc.h"
 #include "log.h"
 #include "map.h"
-#include "primes.h"
+#include "mph.h"
 
-static double load_factor(Map* ht)
+#define map_is_frozen(ht) ((ht)->seeds != NULL)
+
+static void map_alloc_slots(Map* ht, size_t capacity)
 {
-    LOG_DEBUG("Load factor: %.2f", (double) ht->size / (double) ht->capacity);
-    return (double) ht->size / (double) ht->capacity;
+    map_slots_init(&ht->slots, gc_malloc(&gc, map_slots_bytes(capacity)), capacity);
 }
 
-static MapItem* map_item_new(char* key, void* value, size_t siz)
+static MapItem* map_item_new(Symbol* key, void* value)
 {
     MapItem* item = (MapItem*) gc_malloc(&gc, sizeof(MapItem));
-    item->key = gc_strdup(&gc, key);
-    item->size = siz;
-    item->value = gc_malloc(&gc, siz);
-    memcpy(item->value, value, siz);
-    item->next = NULL;
+    item->key = key;
+    item->value = value;
     return item;
 }
 
-static void map_item_delete(MapItem* item)
-{
-    if (item) {
-        gc_free(&gc, item->key);
-        gc_free(&gc, item->value);
-        gc_free(&gc, item);
-    }
-}
-
-Map* map_new(size_t capacity)
+Map* map_new(size_t n)
 {
     Map* ht = (Map*) gc_malloc(&gc, sizeof(Map));
-    ht->capacity = next_prime(capacity);
     ht->size = 0;
-    ht->items = gc_calloc(&gc, ht->capacity, sizeof(MapItem*));
+    memset(&ht->old, 0, sizeof(MapSlots));
+    ht->migrated = 0;
+    ht->frozen = NULL;
+    ht->seeds = NULL;
+    ht->nseeds = 0;
+    if (n <= MAP_SMALL_SIZE) {
+        memset(&ht->slots, 0, sizeof(MapSlots));
+    } else {
+        map_alloc_slots(ht, table_capacity_for(n));
+    }
     return ht;
 }
 
 void map_delete(Map* ht)
 {
-    MapItem* item, *tmp;
-    for (size_t i=0; i < ht->capacity; ++i) {
-        if ((item = ht->items[i]) != NULL) {
-            while (item) {
-                tmp = item;
-                item = item->next;
-                map_item_delete(tmp);
-            }
+    if (map_is_frozen(ht)) {
+        for (size_t i = 0; i < ht->size; ++i) {
+            gc_free(&gc, ht->frozen[i]);
         }
+        gc_free(&gc, ht->frozen);
+        gc_free(&gc, ht);
+        return;
+    }
+    if (!ht->slots.capacity) {
+        for (size_t i = 0; i < ht->size; ++i) {
+            gc_free(&gc, ht->small_items[i]);
+        }
+        gc_free(&gc, ht);
+        return;
+    }
+    for (size_t i=0; i < ht->slots.capacity; ++i) {
+        if (map_slots_full(&ht->slots, i)) {
+            gc_free(&gc, ht->slots.slots[i]);
+        }
+    }
+    for (size_t i=0; i < ht->old.capacity; ++i) {
+        if (map_slots_full(&ht->old, i)) {
+            gc_free(&gc, ht->old.slots[i]);
+        }
+    }
+    if (ht->old.ctrl) {
+        gc_free(&gc, ht->old.ctrl);
     }
-    gc_free(&gc, ht->items);
+    gc_free(&gc, ht->slots.ctrl);
     gc_free(&gc, ht);
 }
 
-unsigned long map_index(Map* map, char* key)
+/*
+ * Moves up to n slots of the old table into the current one. Moved and
+ * removed entries leave deleted slots behind, so probes into the old table
+ * keep working until the last slot has been moved.
+ */
+static void map_migrate(Map* ht, size_t n)
+{
+    if (!ht->old.ctrl) {
+        return;
+    }
+    size_t end = ht->migrated + n < ht->old.capacity ? ht->migrated + n : ht->old.capacity;
+    for (size_t i = ht->migrated; i < end; ++i) {
+        if (map_slots_full(&ht->old, i)) {
+            map_slots_place(&ht->slots, ht->old.slots[i]);
+            ht->old.ctrl[i] = TABLE_DELETED;
+        }
+    }
+    ht->migrated = end;
+    if (end == ht->old.capacity) {
+        LOG_DEBUG("Migrated %zu slots", ht->old.capacity);
+        gc_free(&gc, ht->old.ctrl);
+        memset(&ht->old, 0, sizeof(MapSlots));
+        ht->migrated = 0;
+    }
+}
+
+/* Moves the entries of a small map into slots of the given capacity */
+static void map_grow_small(Map* ht, size_t capacity)
+{
+    LOG_DEBUG("Switching small map to %zu slots", capacity);
+    map_alloc_slots(ht, capacity);
+    for (size_t i = 0; i < ht->size; ++i) {
+        map_slots_place(&ht->slots, ht->small_items[i]);
+    }
+}
+
+/* The only slot a key can be in, if it is in the frozen map at all */
+static inline MapItem* map_frozen_probe(Map* ht, Symbol* key)
 {
-    return djb2(key) % map->capacity;
+    uint32_t seed = ht->seeds[mph_bucket(key->hash, ht->nseeds)];
+    MapItem* item = ht->frozen[mph_slot(key->hash, seed, ht->size)];
+    return item->key == key ? item : NULL;
 }
 
-void map_put(Map* ht, char* key, void* value, size_t siz)
+/* Turns a frozen map back into a small or slotted one */
+static void map_thaw(Map* ht)
 {
-    // hash
-    unsigned long index = map_index(ht, key);
-    LOG_DEBUG("index: %lu", index);
-    // create item
-    MapItem* item = map_item_new(key, value, siz);
-    MapItem* cur = ht->items[index];
-    // update if exists
-    MapItem* prev = NULL;
-    while(cur != NULL) {
-        if (strcmp(cur->key, key) == 0) {
-            // found it
-            item->next = cur->next;
-            if (!prev) {
-                // position 0
-                ht->items[index] = item;
-            } else {
-                // in the list
-                prev->next = item;
+    LOG_DEBUG("Thawing frozen map of %zu entries", ht->size);
+    MapItem** items = ht->frozen;
+    ht->frozen = NULL;
+    ht->seeds = NULL;
+    ht->nseeds = 0;
+    if (ht->size <= MAP_SMALL_SIZE) {
+        for (size_t i = 0; i < ht->size; ++i) {
+            ht->small_keys[i] = items[i]->key;
+            ht->small_items[i] = items[i];
+        }
+    } else {
+        map_alloc_slots(ht, table_capacity_for(ht->size));
+        for (size_t i = 0; i < ht->size; ++i) {
+            map_slots_place(&ht->slots, items[i]);
+        }
+    }
+    gc_free(&gc, items);
+}
+
+/*
+ * Replaces the current slots with a set of the given capacity. Entries move
+ * over MAP_MIGRATE_SLOTS old slots at a time with every later put or remove.
+ */
+static void map_resize_begin(Map* ht, size_t new_capacity)
+{
+    // only one resize at a time
+    map_migrate(ht, ht->old.capacity);
+    size_t capacity = table_capacity_for(ht->size);
+    while (capacity < new_capacity) {
+        capacity *= 2;
+    }
+    LOG_DEBUG("Resizing to %zu", capacity);
+    ht->old = ht->slots;
+    ht->migrated = 0;
+    map_alloc_slots(ht, capacity);
+}
+
+void map_put(Map* ht, Symbol* key, void* value)
+{
+    if (map_is_frozen(ht)) {
+        map_thaw(ht);
+    }
+    if (!ht->slots.capacity) {
+        for (size_t i = 0; i < ht->size; ++i) {
+            if (ht->small_keys[i] == key) {
+                ht->small_items[i]->value = value;
+                return;
             }
-            map_item_delete(cur);
+        }
+        if (ht->size < MAP_SMALL_SIZE) {
+            ht->small_keys[ht->size] = key;
+            ht->small_items[ht->size] = map_item_new(key, value);
+            ht->size++;
             return;
         }
-        prev = cur;
-        cur = cur->next;
+        map_grow_small(ht, table_capacity_for(ht->size + 1));
+    }
+    map_migrate(ht, MAP_MIGRATE_SLOTS);
+    // update if exists, in the current or the old slots
+    size_t slot = map_slots_find(&ht->slots, key);
+    if (slot < ht->slots.capacity) {
+        ht->slots.slots[slot]->value = value;
+        return;
+    }
+    if (ht->old.ctrl && (slot = map_slots_find(&ht->old, key)) < ht->old.capacity) {
+        ht->old.slots[slot]->value = value;
+        return;
+    }
+    MapItem* item = map_item_new(key, value);
+    // insert, reusing a deleted slot if there is one on the way
+    slot = map_slots_find_free(&ht->slots, key->hash);
+    if (map_slots_exhausts(&ht->slots, slot)) {
+        // grow unless deleted slots make up a good part of the load
+        size_t capacity = ht->slots.capacity;
+        map_resize_begin(ht, ht->size + 1 > capacity * 7 / 16 ? capacity * 2 : capacity);
+        slot = map_slots_find_free(&ht->slots, key->hash);
     }
-    // insert (at front of list)
-    cur = ht->items[index];
-    item->next = cur;
-    ht->items[index] = item;
+    map_slots_place_at(&ht->slots, slot, item);
     ht->size++;
-    if (load_factor(ht) > 0.7)
-        map_resize(ht, next_prime(ht->capacity*2));
 }
 
-void* map_get(Map* ht, char* key)
+static MapItem* map_find(Map* ht, Symbol* key)
 {
-    unsigned long index = map_index(ht, key);
-    LOG_DEBUG("index: %lu", index);
-    MapItem* cur = ht->items[index];
-    LOG_DEBUG("ptr: %p", (void *)cur);
-    while(cur != NULL) {
-        if (strcmp(cur->key, key) == 0) {
-            return cur->value;
+    if (map_is_frozen(ht)) {
+        return map_frozen_probe(ht, key);
+    }
+    if (!ht->slots.capacity) {
+        for (size_t i = 0; i < ht->size; ++i) {
+            if (ht->small_keys[i] == key) {
+                return ht->small_items[i];
+            }
+        }
+        return NULL;
+    }
+    size_t slot = map_slots_find(&ht->slots, key);
+    if (slot < ht->slots.capacity) {
+        return ht->slots.slots[slot];
+    }
+    if (ht->old.ctrl) {
+        slot = map_slots_find(&ht->old, key);
+        if (slot < ht->old.capacity) {
+            return ht->old.slots[slot];
         }
-        cur = cur->next;
     }
     return NULL;
 }
 
-void map_remove(Map* ht, char* key)
+void* map_get(Map* ht, Symbol* key)
+{
+    MapItem* item = map_find(ht, key);
+    return item ? item->value : NULL;
+}
+
+/* Where the value of a key is kept, or NULL if the key is not in the map */
+void** map_get_cell(Map* ht, Symbol* key)
+{
+    MapItem* item = map_find(ht, key);
+    return item ? &item->value : NULL;
+}
+
+/*
+ * Batched lookups prefetch all keys' first groups before any of them is
+ * probed, so that their cache misses overlap instead of each lookup
+ * waiting for its own.
+ */
+static void map_prefetch(Map* ht, Symbol** keys, size_t n)
+{
+    if (ht->slots.capacity) {
+        for (size_t i = 0; i < n; ++i) {
+            map_slots_prefetch(&ht->slots, keys[i]);
+        }
+    }
+}
+
+size_t map_get_many(Map* ht, Symbol** keys, void** values, size_t n)
+{
+    map_prefetch(ht, keys, n);
+    size_t found = 0;
+    for (size_t i = 0; i < n; ++i) {
+        values[i] = map_get(ht, keys[i]);
+        found += values[i] != NULL;
+    }
+    return found;
+}
+
+size_t map_get_cells(Map* ht, Symbol** keys, void*** cells, size_t n)
+{
+    map_prefetch(ht, keys, n);
+    size_t found = 0;
+    for (size_t i = 0; i < n; ++i) {
+        cells[i] = map_get_cell(ht, keys[i]);
+        found += cells[i] != NULL;
+    }
+    return found;
+}
+
+void map_remove(Map* ht, Symbol* key)
 {
     // ignores unknown keys
-    unsigned long index = map_index(ht, key);
-    MapItem* cur = ht->items[index];
-    MapItem* prev = NULL;
-    MapItem* tmp = NULL;
-    while(cur != NULL) {
-        // Separate chaining w/ linked lists
-        if (strcmp(cur->key, key) == 0) {
-            LOG_DEBUG("Removing map item at index %lu, pos %lu.", index, cur - ht->items[index]);
-            // found it
-            if (!prev) {
-                // first item in list
-                ht->items[index] = cur->next;
-            } else {
-                // not the first item in the list
-                prev->next = cur->next;
+    if (map_is_frozen(ht)) {
+        if (!map_frozen_probe(ht, key)) {
+            return;
+        }
+        map_thaw(ht);
+    }
+    if (!ht->slots.capacity) {
+        for (size_t i = 0; i < ht->size; ++i) {
+            if (ht->small_keys[i] == key) {
+                gc_free(&gc, ht->small_items[i]);
+                // keep the keys packed, their order does not matter
+                ht->size--;
+                ht->small_keys[i] = ht->small_keys[ht->size];
+                ht->small_items[i] = ht->small_items[ht->size];
+                return;
             }
-            tmp = cur;
-            cur = cur->next;
-            map_item_delete(tmp);
-            ht->size--;
-        } else {
-            // move on
-            LOG_DEBUG("Skipping map item at index %lu, pos %lu.", index, cur - ht->items[index]);
-            prev = cur;
-            cur = cur->next;
         }
+        return;
+    }
+    map_migrate(ht, MAP_MIGRATE_SLOTS);
+    size_t slot = map_slots_find(&ht->slots, key);
+    if (slot < ht->slots.capacity) {
+        LOG_DEBUG("Removing map item at slot %zu.", slot);
+        gc_free(&gc, ht->slots.slots[slot]);
+        map_slots_erase(&ht->slots, slot);
+    } else if (ht->old.ctrl && (slot = map_slots_find(&ht->old, key)) < ht->old.capacity) {
+        LOG_DEBUG("Removing unmigrated map item at slot %zu.", slot);
+        gc_free(&gc, ht->old.slots[slot]);
+        ht->old.ctrl[slot] = TABLE_DELETED;
+    } else {
+        return;
     }
-    if (load_factor(ht) < 0.1)
-        map_resize(ht, next_prime(ht->capacity/2));
+    ht->size--;
+    size_t capacity = ht->slots.capacity;
+    if (!ht->old.ctrl && capacity > MAP_GROUP_SIZE && ht->size < capacity / 10)
+        map_resize_begin(ht, capacity / 2);
 }
 
 void map_resize(Map* ht, size_t new_capacity)
 {
-    // Replaces the existing items array in the hash table
-    // with a resized one and pushes items into the new, correct buckets
-    LOG_DEBUG("Resizing to %lu", new_capacity);
-    MapItem** resized_items = gc_calloc(&gc, new_capacity, sizeof(MapItem*));
+    if (map_is_frozen(ht)) {
+        map_thaw(ht);
+    }
+    if (!ht->slots.capacity) {
+        size_t capacity = table_capacity_for(ht->size);
+        while (capacity < new_capacity) {
+            capacity *= 2;
+        }
+        map_grow_small(ht, capacity);
+        return;
+    }
+    map_resize_begin(ht, new_capacity);
+    map_migrate(ht, ht->old.capacity);
+}
 
-    for (size_t i=0; i<ht->capacity; ++i) {
-        MapItem* item = ht->items[i];
-        while(item) {
-            MapItem* next_item = item->next;
-            unsigned long new_index = djb2(item->key) % new_capacity;
-            item->next = resized_items[new_index];
-            resized_items[new_index] = item;
-            item = next_item;
+/* Copies pointers to the entries of a map into items, which holds ht->size */
+void map_items(Map* ht, MapItem** items)
+{
+    if (map_is_frozen(ht)) {
+        memcpy(items, ht->frozen, ht->size * sizeof(MapItem*));
+        return;
+    }
+    if (!ht->slots.capacity) {
+        memcpy(items, ht->small_items, ht->size * sizeof(MapItem*));
+        return;
+    }
+    size_t k = 0;
+    for (size_t i = 0; i < ht->slots.capacity; ++i) {
+        if (map_slots_full(&ht->slots, i)) {
+            items[k++] = ht->slots.slots[i];
+        }
+    }
+    // entries still waiting to be migrated
+    for (size_t i = 0; i < ht->old.capacity; ++i) {
+        if (map_slots_full(&ht->old, i)) {
+            items[k++] = ht->old.slots[i];
+        }
+    }
+}
+
+/*
+ * Moves the entries of a map into a minimal perfect hash table. Leaves the
+ * map as it is if no such table is found, which only happens if two keys
+ * share their hash.
+ */
+void map_freeze(Map* ht)
+{
+    if (map_is_frozen(ht) || ht->size == 0) {
+        return;
+    }
+    // finish a resize in flight, so that all entries are in one place
+    map_migrate(ht, ht->old.capacity);
+    size_t n = ht->size;
+    size_t nseeds = mph_buckets(n);
+    MapItem** entries = gc_malloc(&gc, n * sizeof(MapItem*));
+    uint64_t* hashes = gc_malloc(&gc, n * sizeof(uint64_t));
+    if (!entries || !hashes) {
+        LOG_WARNING("Out of memory freezing map of %zu entries", n);
+        if (entries) gc_free(&gc, entries);
+        if (hashes) gc_free(&gc, hashes);
+        return;
+    }
+    map_items(ht, entries);
+    for (size_t i = 0; i < n; ++i) {
+        hashes[i] = entries[i]->key->hash;
+    }
+    /* The seeds are stored right behind the slots */
+    MapItem** items = gc_malloc(&gc, n * sizeof(MapItem*) + nseeds * sizeof(uint32_t));
+    if (!items || mph_build(hashes, n, (uint32_t*) (items + n), nseeds) != 0) {
+        LOG_WARNING("Failed to freeze map of %zu entries", n);
+        if (items) gc_free(&gc, items);
+    } else {
+        uint32_t* seeds = (uint32_t*) (items + n);
+        for (size_t i = 0; i < n; ++i) {
+            items[mph_slot(hashes[i], seeds[mph_bucket(hashes[i], nseeds)], n)] = entries[i];
         }
+        if (ht->slots.capacity) {
+            gc_free(&gc, ht->slots.ctrl);
+        }
+        memset(&ht->slots, 0, sizeof(MapSlots));
+        ht->frozen = items;
+        ht->seeds = seeds;
+        ht->nseeds = nseeds;
+    }
+    gc_free(&gc, hashes);
+    gc_free(&gc, entries);
+}
+
+/*
+ * Creates a frozen map from seeds computed ahead of time for the given
+ * keys, in any order, by tools/mph_gen. If the seeds do not place the keys
+ * without collisions, e.g. because the generator used a different hash,
+ * the map is frozen from scratch instead.
+ */
+Map* map_new_frozen(Symbol** keys, void** values, size_t n,
+                    const uint32_t* seeds, size_t nseeds)
+{
+    Map* ht = map_new(0);
+    if (n == 0) {
+        return ht;
     }
-    gc_free(&gc, ht->items);
-    ht->capacity = new_capacity;
-    ht->items = resized_items;
+    MapItem** items = gc_calloc(&gc, 1, n * sizeof(MapItem*) + nseeds * sizeof(uint32_t));
+    bool placed = true;
+    for (size_t i = 0; i < n && placed; ++i) {
+        size_t slot = mph_slot(keys[i]->hash, seeds[mph_bucket(keys[i]->hash, nseeds)], n);
+        placed = !items[slot];
+        items[slot] = placed ? map_item_new(keys[i], values[i]) : items[slot];
+    }
+    if (!placed) {
+        LOG_WARNING("Seeds do not match %zu keys, freezing from scratch", n);
+        for (size_t i = 0; i < n; ++i) {
+            if (items[i]) {
+                gc_free(&gc, items[i]);
+            }
+        }
+        gc_free(&gc, items);
+        for (size_t i = 0; i < n; ++i) {
+            map_put(ht, keys[i], values[i]);
+        }
+        map_freeze(ht);
+        return ht;
+    }
+    memcpy(items + n, seeds, nseeds * sizeof(uint32_t));
+    ht->size = n;
+    ht->frozen = items;
+    ht->seeds = (uint32_t*) (items + n);
+    ht->nseeds = nseeds;
+    return ht;
 }
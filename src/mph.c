@@ -0,0 +1,90 @@
+/*
+ * mph.c
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mph.h"
+
+/*
+ * Finds a seed for every bucket, the largest buckets first while most
+ * slots are still free. Returns 0 on success, or -1 with errno set to
+ * EINVAL if no seed up to MPH_MAX_SEED places some bucket, e.g. because
+ * two hashes are equal.
+ */
+int mph_build(const uint64_t* hashes, size_t n, uint32_t* seeds, size_t nbuckets)
+{
+    /* Sort the keys by bucket, and the buckets by size */
+    size_t* start = calloc(nbuckets + 1, sizeof(size_t));
+    size_t* keys = malloc(n * sizeof(size_t));
+    size_t* order = malloc(nbuckets * sizeof(size_t));
+    size_t* slots = malloc(n * sizeof(size_t));
+    bool* taken = calloc(n, sizeof(bool));
+    int rc = 0;
+    for (size_t i = 0; i < n; ++i) {
+        start[mph_bucket(hashes[i], nbuckets) + 1]++;
+    }
+    size_t largest = 0;
+    for (size_t b = 0; b < nbuckets; ++b) {
+        if (start[b + 1] > largest) {
+            largest = start[b + 1];
+        }
+        start[b + 1] += start[b];
+    }
+    size_t* fill = calloc(nbuckets, sizeof(size_t));
+    for (size_t i = 0; i < n; ++i) {
+        size_t b = mph_bucket(hashes[i], nbuckets);
+        keys[start[b] + fill[b]++] = i;
+    }
+    size_t nordered = 0;
+    for (size_t size = largest; size > 0; --size) {
+        for (size_t b = 0; b < nbuckets; ++b) {
+            if (start[b + 1] - start[b] == size) {
+                order[nordered++] = b;
+            }
+        }
+    }
+    memset(seeds, 0, nbuckets * sizeof(uint32_t));
+
+    for (size_t k = 0; k < nordered && rc == 0; ++k) {
+        size_t b = order[k];
+        size_t size = start[b + 1] - start[b];
+        uint32_t seed;
+        for (seed = 0; seed < MPH_MAX_SEED; ++seed) {
+            size_t i;
+            for (i = 0; i < size; ++i) {
+                size_t slot = mph_slot(hashes[keys[start[b] + i]], seed, n);
+                if (taken[slot]) {
+                    break;
+                }
+                // taken for now, so that keys of the same bucket collide, too
+                taken[slot] = true;
+                slots[i] = slot;
+            }
+            if (i == size) {
+                break;
+            }
+            while (i-- > 0) {
+                taken[slots[i]] = false;
+            }
+        }
+        if (seed == MPH_MAX_SEED) {
+            errno = EINVAL;
+            rc = -1;
+        }
+        seeds[b] = seed;
+    }
+    free(fill);
+    free(taken);
+    free(slots);
+    free(order);
+    free(keys);
+    free(start);
+    return rc;
+}
@@ -0,0 +1,70 @@
+/*
+ * str.c
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include <string.h>
+
+#include "gc.h"
+#include "hash.h"
+#include "str.h"
+
+String* string_new(const char* chars, size_t length)
+{
+    String* s = gc_malloc(&gc, sizeof(String) + length + 1);
+    memcpy(s->buf, chars, length);
+    s->buf[length] = '\0';
+    s->length = length;
+    s->hash = hash_string(s->buf, length);
+    s->hashed = true;
+    s->chars = s->buf;
+    s->base = NULL;
+    return s;
+}
+
+/* The characters from start up to end, clamped to the string */
+String* string_slice(String* s, size_t start, size_t end)
+{
+    end = end < s->length ? end : s->length;
+    start = start < end ? start : end;
+    if (start == 0 && end == s->length) {
+        return s;
+    }
+    String* slice = gc_malloc(&gc, sizeof(String));
+    slice->length = end - start;
+    slice->hash = 0;
+    slice->hashed = false;
+    slice->chars = s->chars + start;
+    // slices of slices share the buffer of the string that owns it
+    slice->base = s->base ? s->base : s;
+    return slice;
+}
+
+uint64_t string_hash(String* s)
+{
+    if (!s->hashed) {
+        s->hash = hash_string(s->chars, s->length);
+        s->hashed = true;
+    }
+    return s->hash;
+}
+
+bool string_equal(String* a, String* b)
+{
+    if (a == b) return true;
+    if (a->length != b->length) return false;
+    if (a->hashed && b->hashed && a->hash != b->hash) return false;
+    return memcmp(a->chars, b->chars, a->length) == 0;
+}
+
+/* Orders strings by their bytes, a prefix comes first */
+int string_compare(const String* a, const String* b)
+{
+    size_t n = a->length < b->length ? a->length : b->length;
+    int c = memcmp(a->chars, b->chars, n);
+    if (c != 0) return c;
+    if (a->length == b->length) return 0;
+    return a->length < b->length ? -1 : 1;
+}
@@ -0,0 +1,78 @@
+/*
+ * symbol.c
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include <string.h>
+
+#include "gc.h"
+#include "hash.h"
+#include "log.h"
+#include "symbol.h"
+
+/*
+ * The intern table is an open-addressing table with linear probing. Its
+ * slot array is a GC root, which keeps all symbols alive.
+ */
+typedef struct SymbolTable {
+    size_t capacity;          // a power of 2
+    size_t size;
+    Symbol** symbols;
+} SymbolTable;
+
+static SymbolTable table = { 0, 0, NULL };
+
+uint64_t symbol_hash(char* name)
+{
+    return hash_string(name, strlen(name));
+}
+
+static void symbol_table_resize(size_t capacity)
+{
+    Symbol** symbols = gc_calloc(&gc, capacity, sizeof(Symbol*));
+    gc_make_root(&gc, symbols);
+    for (size_t i = 0; i < table.capacity; ++i) {
+        Symbol* sym = table.symbols[i];
+        if (sym) {
+            size_t slot = sym->hash & (capacity - 1);
+            while (symbols[slot]) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            symbols[slot] = sym;
+        }
+    }
+    if (table.symbols) {
+        gc_free(&gc, table.symbols);
+    }
+    LOG_DEBUG("Resized symbol table to %zu", capacity);
+    table.capacity = capacity;
+    table.symbols = symbols;
+}
+
+Symbol* symbol_intern(char* name)
+{
+    if (2 * (table.size + 1) > table.capacity) {
+        symbol_table_resize(table.capacity ? 2 * table.capacity : 256);
+    }
+    size_t length = strlen(name);
+    uint64_t hash = hash_string(name, length);
+    size_t slot = hash & (table.capacity - 1);
+    Symbol* sym;
+    while ((sym = table.symbols[slot])) {
+        if (sym->hash == hash && sym->length == length
+                && memcmp(sym->name, name, length) == 0) {
+            return sym;
+        }
+        slot = (slot + 1) & (table.capacity - 1);
+    }
+    sym = gc_malloc(&gc, sizeof(Symbol) + length + 1);
+    sym->hash = hash;
+    sym->length = length;
+    sym->value = NULL;
+    memcpy(sym->name, name, length + 1);
+    table.symbols[slot] = sym;
+    table.size++;
+    return sym;
+}
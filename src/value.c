@@ -6,6 +6,7 @@
  */
 
 #include "value.h"
+#include <stdlib.h>
 #include <string.h>
 #include "log.h"
 #include "gc.h"
@@ -18,24 +19,34 @@ static Value* value_new(ValueType type)
     return v;
 }
 
+static Value* value_from_bits(uint64_t bits)
+{
+    return (Value*) (uintptr_t) bits;
+}
+
 Value* value_new_nil()
 {
-    Value* v = value_new(VALUE_NIL);
-    return v;
+    return value_from_bits(VALUE_NIL_BITS);
+}
+
+Value* value_new_bool(bool b)
+{
+    return value_from_bits(b ? VALUE_TRUE_BITS : VALUE_FALSE_BITS);
 }
 
 Value* value_new_int(int int_)
 {
-    Value* v = value_new(VALUE_INT);
-    v->value.int_ = int_;
-    return v;
+    return value_from_bits(VALUE_INT_TAG | (uint32_t) int_);
 }
 
 Value* value_new_float(float float_)
 {
-    Value* v = value_new(VALUE_FLOAT);
-    v->value.float_ = float_;
-    return v;
+    double d = float_;
+    uint64_t bits = 0x7ff8000000000000ULL;   // the canonical NaN
+    if (d == d) {
+        memcpy(&bits, &d, sizeof(bits));
+    }
+    return value_from_bits(bits + VALUE_DOUBLE_OFFSET);
 }
 
 Value* value_new_fn(Value* (fn)(Value*))
@@ -46,19 +57,41 @@ Value* value_new_fn(Value* (fn)(Value*))
 }
 
 Value* value_new_string(char* str)
+{
+    return value_new_string_from(string_new(str, strlen(str)));
+}
+
+Value* value_new_string_from(String* string)
 {
     Value* v = value_new(VALUE_STRING);
-    v->value.str = gc_strdup(&gc, str);
+    v->value.string = string;
     return v;
 }
 
 Value* value_new_symbol(char* str)
 {
     Value* v = value_new(VALUE_SYMBOL);
-    v->value.str = gc_strdup(&gc, str);
+    v->value.symbol = symbol_intern(str);
     return v;
 }
 
+/*
+ * The one value of an interned symbol. It lives as long as the symbol and
+ * is shared by everyone who asks, so unlike the values of
+ * value_new_symbol() it must never be changed, e.g. by ir_resolve(). The
+ * value is made on first use, so code that must not allocate, like
+ * lookups in snapshots, should not ask for it.
+ */
+Value* value_symbol(Symbol* symbol)
+{
+    if (!symbol->value) {
+        Value* v = value_new(VALUE_SYMBOL);
+        v->value.symbol = symbol;
+        symbol->value = v;
+    }
+    return symbol->value;
+}
+
 Value* value_new_list()
 {
     Value* v = value_new(VALUE_LIST);
@@ -66,17 +99,45 @@ Value* value_new_list()
     return v;
 }
 
+Value* value_new_map(Hamt* hamt)
+{
+    Value* v = value_new(VALUE_MAP);
+    v->value.hamt = hamt ? hamt : hamt_new();
+    return v;
+}
+
+Value* value_new_sorted_map(BTree* btree)
+{
+    Value* v = value_new(VALUE_SORTED_MAP);
+    v->value.btree = btree ? btree : btree_new();
+    return v;
+}
+
+Value* value_new_lambda(Value* args, Value* body, Environment* env)
+{
+    Value* v = value_new(VALUE_LAMBDA);
+    v->value.fun.args = args;
+    v->value.fun.body = body;
+    v->value.fun.env = env;
+    return v;
+}
+
 void value_delete(Value* v)
 {
     if (!v) return;
-    switch(v->type) {
+    switch(value_type(v)) {
     case VALUE_NIL:
+    case VALUE_BOOL:
     case VALUE_INT:
     case VALUE_FLOAT:
-        break;
+        // immediate
+        return;
     case VALUE_STRING:
+        // other values and slices may share the string, the collector frees it
+        break;
     case VALUE_SYMBOL:
-        gc_free(&gc, v->value.str);
+        // interned, and the shared value lives as long as the symbol
+        if (v->value.symbol->value == v) return;
         break;
     case VALUE_LIST:
         list_delete(v->value.list);
@@ -85,6 +146,16 @@ void value_delete(Value* v)
         // not implemented yet
         LOG_WARNING("%s", "value_delete() for VALUE_FN not implemented");
         break;
+    case VALUE_MAP:
+    case VALUE_SORTED_MAP:
+        // nodes may be shared with other maps
+        break;
+    case VALUE_LAMBDA:
+        // the environment may be shared with other closures
+        break;
+    case VALUE_LOCAL:
+    case VALUE_GLOBAL:
+        break;
     }
     gc_free(&gc, v);
 }
@@ -92,19 +163,24 @@ void value_delete(Value* v)
 void value_print(Value* v)
 {
     if (!v) return;
-    switch(v->type) {
+    switch(value_type(v)) {
     case VALUE_NIL:
         printf("NIL");
         break;
+    case VALUE_BOOL:
+        printf(value_bool(v) ? "true" : "false");
+        break;
     case VALUE_INT:
-        printf("%d", v->value.int_);
+        printf("%d", value_int(v));
         break;
     case VALUE_FLOAT:
-        printf("%f", v->value.float_);
+        printf("%f", value_float(v));
         break;
     case VALUE_STRING:
+        printf("%.*s", (int) v->value.string->length, v->value.string->chars);
+        break;
     case VALUE_SYMBOL:
-        printf("%s", v->value.str);
+        printf("%s", v->value.symbol->name);
         break;
     case VALUE_LIST:
         printf("( ");
@@ -120,6 +196,272 @@ void value_print(Value* v)
     case VALUE_FN:
         printf("#<@%p>", (void*) v->value.fn);
         break;
+    case VALUE_LAMBDA:
+        printf("#<lambda@%p>", (void*) v);
+        break;
+    case VALUE_LOCAL:
+        printf("%s", v->value.local.symbol->name);
+        break;
+    case VALUE_GLOBAL:
+        printf("%s", v->value.global.symbol->name);
+        break;
+    case VALUE_MAP:
+        printf("{");
+        HamtIter it;
+        Value* key;
+        Value* value;
+        bool first = true;
+        hamt_iter_init(&it, v->value.hamt);
+        while (hamt_iter_next(&it, &key, &value)) {
+            printf(first ? " " : ", ");
+            value_print(key);
+            printf(" ");
+            value_print(value);
+            first = false;
+        }
+        printf(" }");
+        break;
+    case VALUE_SORTED_MAP: {
+        BTreeIter it;
+        Value* key;
+        Value* value;
+        bool first = true;
+        printf("{");
+        btree_iter_init(&it, v->value.btree, NULL, NULL);
+        while (btree_iter_next(&it, &key, &value)) {
+            printf(first ? " " : ", ");
+            value_print(key);
+            printf(" ");
+            value_print(value);
+            first = false;
+        }
+        printf(" }");
+        break;
+    }
     }
 
 }
+
+bool value_equal(Value* a, Value* b)
+{
+    if (a == b) return true;
+    if (!a || !b || value_type(a) != value_type(b)) return false;
+    switch(value_type(a)) {
+    case VALUE_NIL:
+    case VALUE_BOOL:
+    case VALUE_INT:
+        // immediates with the same contents are the same pointer
+        return false;
+    case VALUE_FLOAT:
+        return value_float(a) == value_float(b);
+    case VALUE_STRING:
+        return string_equal(a->value.string, b->value.string);
+    case VALUE_SYMBOL:
+        return a->value.symbol == b->value.symbol;
+    case VALUE_LIST: {
+        List* la = a->value.list;
+        List* lb = b->value.list;
+        if (list_size(la) != list_size(lb)) return false;
+        Value* head;
+        while ((head = list_head(la)) != NULL) {
+            if (!value_equal(head, list_head(lb))) return false;
+            la = list_tail(la);
+            lb = list_tail(lb);
+        }
+        return true;
+    }
+    case VALUE_FN:
+        return a->value.fn == b->value.fn;
+    case VALUE_MAP:
+        return hamt_equal(a->value.hamt, b->value.hamt);
+    case VALUE_SORTED_MAP:
+        return btree_size(a->value.btree) == btree_size(b->value.btree)
+               && btree_compare(a->value.btree, b->value.btree) == 0;
+    case VALUE_LAMBDA:
+        // closures are only equal to themselves
+        return false;
+    case VALUE_LOCAL:
+        return a->value.local.depth == b->value.local.depth
+               && a->value.local.slot == b->value.local.slot;
+    case VALUE_GLOBAL:
+        return a->value.global.symbol == b->value.global.symbol;
+    }
+    return false;
+}
+
+static bool value_is_number(Value* v)
+{
+    return value_type(v) == VALUE_INT || value_type(v) == VALUE_FLOAT;
+}
+
+static double value_number(Value* v)
+{
+    return value_type(v) == VALUE_INT ? value_int(v) : value_float(v);
+}
+
+typedef struct ValueEntry {
+    Value* key;
+    Value* value;
+} ValueEntry;
+
+static int value_entry_compare(const void* a, const void* b)
+{
+    return value_compare(((const ValueEntry*) a)->key, ((const ValueEntry*) b)->key);
+}
+
+/* The entries of a hash map, ordered by key */
+static ValueEntry* value_hamt_entries(const Hamt* hamt)
+{
+    size_t n = hamt_size(hamt);
+    ValueEntry* entries = gc_malloc(&gc, (n ? n : 1) * sizeof(ValueEntry));
+    HamtIter it;
+    Value* key;
+    Value* value;
+    hamt_iter_init(&it, hamt);
+    for (size_t i = 0; hamt_iter_next(&it, &key, &value); ++i) {
+        entries[i] = (ValueEntry) { key, value };
+    }
+    qsort(entries, n, sizeof(ValueEntry), value_entry_compare);
+    return entries;
+}
+
+/* Hash maps order by size, then entry by entry in the order of their keys */
+static int value_hamt_compare(const Hamt* a, const Hamt* b)
+{
+    if (hamt_size(a) != hamt_size(b)) return hamt_size(a) < hamt_size(b) ? -1 : 1;
+    if (hamt_equal(a, b)) return 0;
+    ValueEntry* ea = value_hamt_entries(a);
+    ValueEntry* eb = value_hamt_entries(b);
+    int c = 0;
+    for (size_t i = 0; i < hamt_size(a) && c == 0; ++i) {
+        c = value_compare(ea[i].key, eb[i].key);
+        if (c == 0) c = value_compare(ea[i].value, eb[i].value);
+    }
+    gc_free(&gc, eb);
+    gc_free(&gc, ea);
+    return c;
+}
+
+/*
+ * A total order of all values that agrees with value_equal(). Numbers
+ * compare by magnitude, with an int before an equal float and NaN after
+ * all other numbers. Strings and symbols compare by their characters,
+ * lists and maps element by element, hash maps after ordering their
+ * entries by key. Values of other types come in the order of their type.
+ * Functions compare by the builtin they wrap, closures, which are only
+ * equal to themselves, by address.
+ */
+int value_compare(Value* a, Value* b)
+{
+    if (a == b) return 0;
+    if (!a || !b) return a ? 1 : -1;
+    if (value_is_number(a) && value_is_number(b)) {
+        double x = value_number(a);
+        double y = value_number(b);
+        // NaNs are canonical, so a NaN here is never equal to the other value
+        if (x != x || y != y) return (x != x) - (y != y);
+        if (x != y) return x < y ? -1 : 1;
+        return (int) value_type(a) - (int) value_type(b);
+    }
+    if (value_type(a) != value_type(b)) return value_type(a) < value_type(b) ? -1 : 1;
+    switch(value_type(a)) {
+    case VALUE_NIL:
+        return 0;
+    case VALUE_BOOL:
+        return (int) value_bool(a) - (int) value_bool(b);
+    case VALUE_STRING:
+        return string_compare(a->value.string, b->value.string);
+    case VALUE_SYMBOL:
+        return a->value.symbol == b->value.symbol
+               ? 0 : strcmp(a->value.symbol->name, b->value.symbol->name);
+    case VALUE_LIST: {
+        List* la = a->value.list;
+        List* lb = b->value.list;
+        Value* ha;
+        Value* hb;
+        while ((ha = list_head(la)) != NULL && (hb = list_head(lb)) != NULL) {
+            int c = value_compare(ha, hb);
+            if (c != 0) return c;
+            la = list_tail(la);
+            lb = list_tail(lb);
+        }
+        // the shorter list comes first
+        return (list_head(la) != NULL) - (list_head(lb) != NULL);
+    }
+    case VALUE_MAP:
+        return value_hamt_compare(a->value.hamt, b->value.hamt);
+    case VALUE_SORTED_MAP:
+        return btree_compare(a->value.btree, b->value.btree);
+    case VALUE_FN: {
+        uintptr_t fa = (uintptr_t) a->value.fn;
+        uintptr_t fb = (uintptr_t) b->value.fn;
+        return fa == fb ? 0 : fa < fb ? -1 : 1;
+    }
+    case VALUE_LOCAL:
+        if (a->value.local.depth != b->value.local.depth) {
+            return a->value.local.depth < b->value.local.depth ? -1 : 1;
+        }
+        return a->value.local.slot == b->value.local.slot
+               ? 0 : a->value.local.slot < b->value.local.slot ? -1 : 1;
+    case VALUE_GLOBAL:
+        return a->value.global.symbol == b->value.global.symbol
+               ? 0 : strcmp(a->value.global.symbol->name, b->value.global.symbol->name);
+    default:
+        return (uintptr_t) a < (uintptr_t) b ? -1 : 1;
+    }
+}
+
+static uint64_t value_mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
+}
+
+uint64_t value_hash(Value* v)
+{
+    if (!v) return 0;
+    switch(value_type(v)) {
+    case VALUE_NIL:
+        return 0;
+    case VALUE_BOOL:
+        return value_mix(value_bits(v));
+    case VALUE_INT:
+        return value_mix((uint64_t) value_int(v));
+    case VALUE_FLOAT: {
+        // 0.0 and -0.0 are equal, so they must hash alike
+        double f = value_float(v) == 0.0 ? 0.0 : value_float(v);
+        uint64_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        return value_mix(bits);
+    }
+    case VALUE_STRING:
+        return string_hash(v->value.string);
+    case VALUE_SYMBOL:
+        return v->value.symbol->hash;
+    case VALUE_LIST: {
+        uint64_t hash = VALUE_LIST;
+        Value* head;
+        List* tail = v->value.list;
+        while ((head = list_head(tail)) != NULL) {
+            hash = value_mix(hash * 31 + value_hash(head));
+            tail = list_tail(tail);
+        }
+        return hash;
+    }
+    case VALUE_FN:
+        return value_mix((uintptr_t) v->value.fn);
+    case VALUE_MAP:
+        return hamt_hash(v->value.hamt);
+    case VALUE_SORTED_MAP:
+        return btree_hash(v->value.btree);
+    case VALUE_LAMBDA:
+        return value_mix((uintptr_t) v);
+    case VALUE_LOCAL:
+        return value_mix(((uint64_t) v->value.local.depth << 32) | v->value.local.slot);
+    case VALUE_GLOBAL:
+        return v->value.global.symbol->hash;
+    }
+    return 0;
+}
@@ -0,0 +1,173 @@
+/*
+ * test_btree.c
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "minunit.h"
+#include "btree.h"
+#include "value.h"
+
+static char* test_value_compare()
+{
+    mu_assert(value_compare(value_new_int(1), value_new_int(2)) < 0, "Ints should order by value");
+    mu_assert(value_compare(value_new_float(2.5), value_new_int(2)) > 0,
+              "Numbers should order by value across types");
+    mu_assert(value_compare(value_new_int(1), value_new_float(1.0)) < 0,
+              "An int should come before an equal float");
+    mu_assert(value_compare(value_new_string("abc"), value_new_string("abd")) < 0,
+              "Strings should order by their characters");
+    mu_assert(value_compare(value_new_string("abc"), value_new_string("abc")) == 0,
+              "Equal strings should compare equal");
+    mu_assert(value_compare(value_new_nil(), value_new_int(0)) < 0, "Nil should come first");
+
+    Value* nan = value_new_float(0.0 / 0.0);
+    mu_assert(value_compare(nan, value_new_int(1)) > 0 && value_compare(value_new_int(1), nan) < 0,
+              "NaN should come after all other numbers");
+    mu_assert(value_compare(nan, value_new_float(0.0 / 0.0)) == 0, "NaN should equal itself");
+
+    /* Hash maps order by their entries, not by where they live */
+    Hamt* one = hamt_assoc(hamt_new(), value_new_int(1), value_new_int(1));
+    Value* m1 = value_new_map(one);
+    Value* m2 = value_new_map(hamt_assoc(hamt_new(), value_new_int(1), value_new_int(1)));
+    Value* m3 = value_new_map(hamt_assoc(hamt_new(), value_new_int(1), value_new_int(2)));
+    Value* m4 = value_new_map(hamt_assoc(one, value_new_int(0), value_new_int(0)));
+    mu_assert(value_compare(m1, m2) == 0, "Equal maps should compare equal");
+    mu_assert(value_compare(m1, m3) < 0 && value_compare(m3, m1) > 0,
+              "Maps should order by their values");
+    mu_assert(value_compare(m2, m3) == value_compare(m1, m3), "Equal maps should order alike");
+    mu_assert(value_compare(m3, m4) < 0, "Smaller maps should come first");
+    return NULL;
+}
+
+static char* test_value_immediates()
+{
+    Value* i = value_new_int(-5);
+    Value* f = value_new_float(2.5);
+    Value* t = value_new_bool(true);
+    mu_assert(i == value_new_int(-5), "Equal ints should be the same value");
+    mu_assert(value_type(i) == VALUE_INT && value_int(i) == -5, "Ints should keep their sign");
+    mu_assert(value_type(f) == VALUE_FLOAT && value_float(f) == 2.5, "Floats should round-trip");
+    mu_assert(value_type(value_new_float(0.0 / 0.0)) == VALUE_FLOAT, "NaN should stay a float");
+    mu_assert(value_type(t) == VALUE_BOOL && value_bool(t), "Booleans should round-trip");
+    mu_assert(!value_bool(value_new_bool(false)), "False should be false");
+    mu_assert(value_type(value_new_nil()) == VALUE_NIL, "Nil should be nil");
+    mu_assert(value_type(value_new_string("x")) == VALUE_STRING, "Strings should live on the heap");
+    return NULL;
+}
+
+static char* test_btree()
+{
+    BTree* empty = btree_new();
+    Value* key = value_new_int(0);
+    mu_assert(btree_size(empty) == 0, "New map should be empty");
+    mu_assert(btree_get(empty, key) == NULL, "New map should not find keys");
+
+    /* Insert out of order, deep enough to split nodes */
+    const int n = 200;
+    BTree* tree = empty;
+    for (int i = 0; i < n; ++i) {
+        int k = (i * 7) % n;
+        tree = btree_assoc(tree, value_new_int(k), value_new_int(2 * k));
+    }
+    mu_assert(btree_size(tree) == (size_t) n, "Map should hold all entries");
+    mu_assert(tree->height > 0, "Map should have split its root");
+    mu_assert(btree_size(empty) == 0, "Assoc must not change the old map");
+    for (int i = 0; i < n; ++i) {
+        Value* v = btree_get(tree, value_new_int(i));
+        mu_assert(v && value_int(v) == 2 * i, "Get should find all entries");
+    }
+    Value* v = btree_get(tree, value_new_int(3));
+    mu_assert(btree_assoc(tree, value_new_int(3), v) == tree,
+              "Assoc of an equal entry should be a no-op");
+
+    /* Ordered iteration */
+    BTreeIter it;
+    Value* k;
+    int expect = 0;
+    btree_iter_init(&it, tree, NULL, NULL);
+    while (btree_iter_next(&it, &k, &v)) {
+        mu_assert(value_int(k) == expect, "Iteration should visit keys in order");
+        expect++;
+    }
+    mu_assert(expect == n, "Iteration should visit every entry once");
+
+    /* Ranges include their lower and exclude their upper bound */
+    expect = 50;
+    btree_iter_init(&it, tree, value_new_int(50), value_new_int(60));
+    while (btree_iter_next(&it, &k, &v)) {
+        mu_assert(value_int(k) == expect, "Range should visit keys in order");
+        expect++;
+    }
+    mu_assert(expect == 60, "Range should stop at its upper bound");
+    BTree* slice = btree_slice(tree, value_new_float(49.5), value_new_int(60));
+    mu_assert(btree_size(slice) == 10, "Slice should hold the entries in range");
+    mu_assert(btree_get(slice, value_new_int(50)) != NULL, "Slice should hold its first key");
+    mu_assert(btree_get(slice, value_new_int(60)) == NULL, "Slice should exclude its end");
+    mu_assert(btree_size(btree_slice(tree, NULL, value_new_int(100))) == 100,
+              "Slice without lower bound should start at the least key");
+    mu_assert(btree_slice(tree, NULL, NULL) == tree, "Unbounded slice should be the map");
+
+    /* Remove every other entry, nodes merge on the way */
+    BTree* odd = tree;
+    for (int i = 0; i < n; i += 2) {
+        odd = btree_dissoc(odd, value_new_int(i));
+    }
+    mu_assert(btree_size(odd) == (size_t) n / 2, "Dissoc should remove entries");
+    mu_assert(btree_dissoc(odd, value_new_int(0)) == odd, "Dissoc of unknown keys is a no-op");
+    mu_assert(btree_get(tree, value_new_int(0)) != NULL, "Dissoc must not change the old map");
+    expect = 1;
+    btree_iter_init(&it, odd, NULL, NULL);
+    while (btree_iter_next(&it, &k, &v)) {
+        mu_assert(value_int(k) == expect, "Remaining keys should stay in order");
+        expect += 2;
+    }
+    mu_assert(expect == n + 1, "Dissoc should keep all other entries");
+    while (btree_size(odd) > 0) {
+        btree_iter_init(&it, odd, NULL, NULL);
+        btree_iter_next(&it, &k, &v);
+        odd = btree_dissoc(odd, k);
+    }
+    mu_assert(odd->height == 0, "Empty map should shrink to a leaf");
+    return NULL;
+}
+
+static char* test_btree_from_sorted()
+{
+    const int n = 1100;
+    Value** keys = gc_malloc(&gc, 2 * n * sizeof(Value*));
+    Value** values = keys + n;
+    for (int i = 0; i < n; ++i) {
+        keys[i] = value_new_int(i);
+        values[i] = value_new_int(-i);
+    }
+    BTree* tree = btree_from_sorted(keys, values, n);
+    mu_assert(btree_size(tree) == (size_t) n, "Bulk load should hold all entries");
+    mu_assert(tree->height == 2, "Bulk load should pack nodes");
+    for (int i = 0; i < n; ++i) {
+        Value* v = btree_get(tree, keys[i]);
+        mu_assert(v && value_int(v) == -i, "Get should find bulk loaded entries");
+    }
+    tree = btree_assoc(tree, value_new_int(n), value_new_int(-n));
+    mu_assert(btree_get(tree, value_new_int(n)) != NULL, "Bulk loaded maps should grow");
+
+    /* Unsorted input, later keys win */
+    Value* unsorted[3] = { value_new_int(2), value_new_int(1), value_new_int(2) };
+    Value* vals[3] = { value_new_int(0), value_new_int(1), value_new_int(3) };
+    BTree* small = btree_from_sorted(unsorted, vals, 3);
+    mu_assert(btree_size(small) == 2, "Unsorted input should still be loaded");
+    mu_assert(value_int(btree_get(small, unsorted[0])) == 3, "Later keys should win");
+
+    /* Equality does not depend on how a map was built */
+    BTree* built = btree_new();
+    for (int i = 99; i >= 0; --i) {
+        built = btree_assoc(built, keys[i], values[i]);
+    }
+    BTree* loaded = btree_from_sorted(keys, values, 100);
+    mu_assert(btree_compare(built, loaded) == 0, "Maps with equal entries should be equal");
+    mu_assert(btree_hash(built) == btree_hash(loaded), "Equal maps should hash alike");
+    mu_assert(btree_compare(loaded, tree) < 0, "A prefix should come first");
+    gc_free(&gc, keys);
+    return NULL;
+}
@@ -0,0 +1,156 @@
+/*
+ * test_cmap.c
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "minunit.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "cmap.h"
+#include "gc.h"
+#include "value.h"
+
+#define CMAP_TEST_THREADS 4
+#define CMAP_TEST_KEYS 250
+
+typedef struct CMapTest {
+    CMap* map;
+    Symbol** keys;
+    int first;                // writers put keys [first, first + CMAP_TEST_KEYS)
+    atomic_int* writing;      // writers still running
+    int errors;
+} CMapTest;
+
+/* The values of all keys, i for the i-th key, allocated before the threads start */
+static int* cmap_test_values[(CMAP_TEST_THREADS + 1) * CMAP_TEST_KEYS];
+
+static void* cmap_test_writer(void* arg)
+{
+    CMapTest* t = arg;
+    for (int i = t->first; i < t->first + CMAP_TEST_KEYS; ++i) {
+        cmap_put(t->map, t->keys[i], cmap_test_values[i]);
+    }
+    // remove and put back every other key
+    for (int i = t->first; i < t->first + CMAP_TEST_KEYS; i += 2) {
+        cmap_remove(t->map, t->keys[i]);
+        cmap_put(t->map, t->keys[i], cmap_test_values[i]);
+    }
+    atomic_fetch_sub(t->writing, 1);
+    return NULL;
+}
+
+static void* cmap_test_reader(void* arg)
+{
+    /* keys [0, CMAP_TEST_KEYS) were there from the start and never change */
+    CMapTest* t = arg;
+    do {
+        for (int i = 0; i < CMAP_TEST_KEYS; ++i) {
+            int* value = cmap_get(t->map, t->keys[i]);
+            if (!value || *value != i) {
+                t->errors++;
+            }
+        }
+    } while (atomic_load(t->writing) > 0);
+    return NULL;
+}
+
+static char* test_cmap()
+{
+    CMap* m = cmap_new(0);
+    Symbol* key = symbol_intern("key");
+    char* inserted = gc_strdup(&gc, "value");
+    cmap_put(m, key, inserted);
+    char* value = (char*) cmap_get(m, key);
+    mu_assert(value != NULL, "Query must find inserted key");
+    mu_assert(value == inserted, "Query must return the inserted value itself");
+    cmap_put(m, key, gc_strdup(&gc, "other"));
+    value = (char*) cmap_get(m, key);
+    mu_assert(value && strcmp(value, "other") == 0, "Query must return updated value");
+    cmap_remove(m, key);
+    mu_assert(cmap_get(m, key) == NULL, "Query must NOT find deleted key");
+    mu_assert(cmap_size(m) == 0, "Map should be empty");
+    cmap_delete(m);
+    return 0;
+}
+
+/* Fills a map with fresh values, leaving no other references to them behind */
+static void __attribute__((noinline)) cmap_test_fill(CMap* m, Symbol** keys, int n)
+{
+    char name[16];
+    for (int i = 0; i < n; ++i) {
+        snprintf(name, sizeof(name), "fresh%d", i);
+        cmap_put(m, keys[i], value_new_string(name));
+    }
+}
+
+static char* test_cmap_gc()
+{
+    Symbol* keys[CMAP_TEST_KEYS];
+    char name[16];
+    for (int i = 0; i < CMAP_TEST_KEYS; ++i) {
+        snprintf(name, sizeof(name), "gc%d", i);
+        keys[i] = symbol_intern(name);
+    }
+    CMap* m = cmap_new(0);
+    cmap_test_fill(m, keys, CMAP_TEST_KEYS);
+    gc_run(&gc);
+    for (int i = 0; i < CMAP_TEST_KEYS; ++i) {
+        Value* value = cmap_get(m, keys[i]);
+        snprintf(name, sizeof(name), "fresh%d", i);
+        mu_assert(value && value_type(value) == VALUE_STRING
+                  && strcmp(value->value.string->chars, name) == 0,
+                  "Values must survive collections unchanged");
+    }
+    cmap_reclaim(m);
+    cmap_delete(m);
+    return 0;
+}
+
+static char* test_cmap_threads()
+{
+    Symbol* keys[(CMAP_TEST_THREADS + 1) * CMAP_TEST_KEYS];
+    char name[16];
+    // the collector does not scan the values array, keep it from running until they are in the map
+    gc_pause(&gc);
+    for (int i = 0; i < (CMAP_TEST_THREADS + 1) * CMAP_TEST_KEYS; ++i) {
+        snprintf(name, sizeof(name), "k%d", i);
+        keys[i] = symbol_intern(name);
+        cmap_test_values[i] = gc_malloc(&gc, sizeof(int));
+        *cmap_test_values[i] = i;
+    }
+    CMap* m = cmap_new(0);
+    for (int i = 0; i < CMAP_TEST_KEYS; ++i) {
+        cmap_put(m, keys[i], cmap_test_values[i]);
+    }
+    atomic_int writing = CMAP_TEST_THREADS;
+    CMapTest tests[2 * CMAP_TEST_THREADS];
+    pthread_t threads[2 * CMAP_TEST_THREADS];
+    for (int i = 0; i < 2 * CMAP_TEST_THREADS; ++i) {
+        tests[i] = (CMapTest) {
+            m, keys, (i % CMAP_TEST_THREADS + 1) * CMAP_TEST_KEYS, &writing, 0
+        };
+        pthread_create(&threads[i], NULL, i < CMAP_TEST_THREADS ? cmap_test_writer : cmap_test_reader,
+                       &tests[i]);
+    }
+    int errors = 0;
+    for (int i = 0; i < 2 * CMAP_TEST_THREADS; ++i) {
+        pthread_join(threads[i], NULL);
+        errors += tests[i].errors;
+    }
+    gc_resume(&gc);
+    mu_assert(errors == 0, "Readers must always find unchanged keys");
+    mu_assert(cmap_size(m) == (CMAP_TEST_THREADS + 1) * CMAP_TEST_KEYS,
+              "Map must hold the keys of all writers");
+    for (int i = 0; i < (CMAP_TEST_THREADS + 1) * CMAP_TEST_KEYS; ++i) {
+        int* value = cmap_get(m, keys[i]);
+        mu_assert(value && *value == i, "Map must hold the latest value of every key");
+    }
+    cmap_reclaim(m);
+    cmap_delete(m);
+    return 0;
+}
+
@@ -15,15 +15,16 @@ static char* test_env()
      * creation
      */
     Environment* env0 = env_new(NULL);
-    mu_assert(env_get(env0, "some_key") == NULL, "New env should be empty");
+    mu_assert(env_get(env0, symbol_intern("some_key")) == NULL, "New env should be empty");
     /*
      * get/set
      */
     Value* val0 = value_new_int(42);
-    env_set(env0, "key1", val0);
-    Value* ret0 = env_get(env0, "key1");
-    mu_assert(ret0->type = VALUE_INT, "value type must not change");
-    mu_assert(42 == ret0->value.int_, "Value must not change");
+    env_set(env0, symbol_intern("key1"), val0);
+    Value* ret0 = env_get(env0, symbol_intern("key1"));
+    mu_assert(ret0 == val0, "Env must hold values, not copies");
+    mu_assert(value_type(ret0) == VALUE_INT, "value type must not change");
+    mu_assert(42 == value_int(ret0), "Value must not change");
     /*
      * nesting
      */
@@ -31,10 +32,37 @@ static char* test_env()
     mu_assert(env1->parent == env0, "Failed to set parent");
     Environment* env2 = env_new(env1);
     mu_assert(env2->parent == env1, "Failed to set parent");
-    ret0 = env_get(env2, "key1");
+    ret0 = env_get(env2, symbol_intern("key1"));
     mu_assert(ret0 != NULL, "Should find key in nested env");
-    mu_assert(ret0->type = VALUE_INT, "Value type must not change");
-    mu_assert(42 == ret0->value.int_, "Value must not change");
+    mu_assert(value_type(ret0) == VALUE_INT, "Value type must not change");
+    mu_assert(42 == value_int(ret0), "Value must not change");
+
+    /*
+     * batched lookup across nesting levels
+     */
+    env_set(env1, symbol_intern("key2"), value_new_int(43));
+    Symbol* symbols[] = { symbol_intern("key2"), symbol_intern("some_key"), symbol_intern("key1") };
+    Value* values[3];
+    mu_assert(env_get_many(env2, symbols, values, 3) == 2, "Should find keys in nested envs");
+    mu_assert(value_int(values[0]) == 43, "Should resolve from the parent");
+    mu_assert(values[1] == NULL, "Should not resolve unknown keys");
+    mu_assert(value_int(values[2]) == 42, "Should resolve from the grandparent");
+
+    /*
+     * frames hold their variables in slots
+     */
+    Environment* frame0 = env_new_frame(env2, 2);
+    Environment* frame1 = env_new_frame(frame0, 1);
+    mu_assert(frame0->nslots == 2 && frame0->slots[1] == NULL, "New frame should be empty");
+    frame0->slots[1] = val0;
+    frame1->slots[0] = value_new_int(7);
+    mu_assert(value_int(env_get_local(frame1, 0, 0)) == 7, "Should find slot in frame");
+    mu_assert(env_get_local(frame1, 1, 1) == val0, "Should find slot in enclosing frame");
+    mu_assert(value_int(env_get(frame1, symbol_intern("key2"))) == 43,
+              "Frames should pass named lookups on");
+    env_set(frame1, symbol_intern("key3"), val0);
+    mu_assert(value_int(env_get(env2, symbol_intern("key3"))) == 42,
+              "Frames should pass definitions on");
 
     env_delete(env2);
     env_delete(env1);
@@ -42,3 +70,58 @@ static char* test_env()
 
     return 0;
 }
+
+static char* test_env_snapshot()
+{
+    Environment* env0 = env_new(NULL);
+    env_set(env0, symbol_intern("x"), value_new_int(1));
+    Environment* env1 = env_new(env0);
+    env_set(env1, symbol_intern("y"), value_new_int(2));
+    Environment* frame = env_new_frame(env1, 1);
+    frame->slots[0] = value_new_int(3);
+
+    mu_assert(env1->bindings == NULL, "Bindings should wait for the first snapshot");
+    Environment* snap = env_snapshot(frame);
+    mu_assert(snap->parent->bindings == env1->bindings, "Snapshots should share bindings");
+    mu_assert(value_int(env_get_local(snap, 0, 0)) == 3, "Snapshots should share slots");
+    mu_assert(value_int(env_get(snap, symbol_intern("x"))) == 1,
+              "Snapshots should see the parents' bindings");
+
+    /* later definitions do not show in the snapshot */
+    env_set(env0, symbol_intern("x"), value_new_int(10));
+    env_set(env1, symbol_intern("z"), value_new_int(20));
+    mu_assert(value_int(env_get(frame, symbol_intern("x"))) == 10, "Env should see redefinitions");
+    mu_assert(value_int(env_get(snap, symbol_intern("x"))) == 1, "Snapshot should stay as it was");
+    mu_assert(env_get(snap, symbol_intern("z")) == NULL, "Snapshot should not see new bindings");
+    Symbol* unbound = symbol_intern("never-bound");
+    mu_assert(env_get(snap, unbound) == NULL && unbound->value == NULL,
+              "Snapshot lookups should not allocate symbol values");
+
+    /* definitions in a snapshot only show in that snapshot */
+    Environment* other = env_snapshot(env1);
+    env_set(snap, symbol_intern("y"), value_new_int(30));
+    mu_assert(value_int(env_get(snap, symbol_intern("y"))) == 30, "Snapshots should be writable");
+    mu_assert(value_int(env_get(env1, symbol_intern("y"))) == 2, "Env should not see snapshots");
+    mu_assert(value_int(env_get(other, symbol_intern("y"))) == 2,
+              "Snapshots should not see each other");
+
+    Symbol* symbols[] = { symbol_intern("z"), symbol_intern("y"), symbol_intern("x") };
+    Value* values[3];
+    mu_assert(env_get_many(snap, symbols, values, 3) == 2, "Should look up many in snapshots");
+    mu_assert(values[0] == NULL && value_int(values[1]) == 30 && value_int(values[2]) == 1,
+              "Batched lookups should see the snapshot");
+
+    /* frozen environments get their bindings in one go */
+    Symbol* names[] = { symbol_intern("a"), symbol_intern("b") };
+    Value* vals[] = { value_new_int(1), value_new_int(2) };
+    uint32_t seeds[] = { 0 };
+    Environment* frozen = env_new_frozen(names, vals, 2, seeds, 1);
+    mu_assert(frozen->bindings == NULL, "Frozen environments should start without bindings");
+    Environment* thawed = env_snapshot(frozen);
+    mu_assert(env_get(thawed, names[1]) == vals[1], "Snapshots should see frozen bindings");
+
+    env_delete(frozen);
+    env_delete(env1);
+    env_delete(env0);
+    return 0;
+}
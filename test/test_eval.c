@@ -0,0 +1,175 @@
+/*
+ * test_eval.c
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "minunit.h"
+#include "core.h"
+#include "eval.h"
+#include "ir.h"
+#include "reader.h"
+
+static Value* eval_read(char* input)
+{
+    FILE* stream = fmemopen(input, strlen(input), "r");
+    Reader* reader = reader_new(stream);
+    AstSexpr* ast = reader_read(reader);
+    reader_delete(reader);
+    Value* ir = ir_from_ast(ast);
+    ast_delete_sexpr(ast);
+    return ir_resolve(ir);
+}
+
+static Value* eval_string(char* input, Environment* env)
+{
+    return eval(eval_read(input), env);
+}
+
+static char* test_eval()
+{
+    Environment* env = env_new(NULL);
+    env_set(env, symbol_intern("sum"), value_new_fn(core_sum));
+
+    char call[] = "((lambda (x y) (sum x y)) 1 2)";
+    Value* v = eval_string(call, env);
+    mu_assert(v && value_int(v) == 3, "Lambdas should bind their arguments");
+
+    char let[] = "(let (x 1 y 2) (sum x y))";
+    v = eval_string(let, env);
+    mu_assert(v && value_int(v) == 3, "Lets should bind their variables");
+
+    char closure[] = "((let (x 5) (lambda (y) (sum x y))) 10)";
+    v = eval_string(closure, env);
+    mu_assert(v && value_int(v) == 15, "Closures should see their defining frames");
+
+    char shadow[] = "(let (x 1) (let (x 2) x))";
+    v = eval_string(shadow, env);
+    mu_assert(v && value_int(v) == 2, "Inner variables should shadow outer ones");
+
+    char twice[] = "(let (f (lambda (x) (sum x 1))) (sum (f 1) (f 2)))";
+    v = eval_string(twice, env);
+    mu_assert(v && value_int(v) == 5, "Lambdas should be callable more than once");
+
+    char arity[] = "((lambda (x) x) 1 2)";
+    mu_assert(eval_string(arity, env) == NULL, "Lambdas should check their arity");
+
+    env_delete(env);
+    return 0;
+}
+
+static char* test_eval_global()
+{
+    Environment* builtins = env_new(NULL);
+    env_set(builtins, symbol_intern("sum"), value_new_fn(core_sum));
+    Environment* env = env_new(builtins);
+    env_set(env, symbol_intern("x"), value_new_int(1));
+
+    char input[] = "(sum x 1)";
+    Value* expr = eval_read(input);
+    Value* x = list_head(list_tail(expr->value.list));
+    Value* v = eval(expr, env);
+    mu_assert(v && value_int(v) == 2, "Globals should resolve");
+    Value** cell = x->value.global.cell;
+    mu_assert(cell == env_get_cell(env, symbol_intern("x")), "Sites should cache the cell");
+    mu_assert(x->value.global.version == env_version, "Sites should stamp the cache");
+
+    env_set(env, symbol_intern("x"), value_new_int(5));
+    mu_assert(env_get_cell(env, symbol_intern("x")) == cell, "Redefinitions should keep the cell");
+    v = eval(expr, env);
+    mu_assert(v && value_int(v) == 6, "Sites should see redefinitions");
+
+    uint64_t version = env_version;
+    Environment* inner = env_new(env);
+    env_set(inner, symbol_intern("x"), value_new_int(10));
+    mu_assert(env_version != version, "New bindings should change the version");
+    v = eval(expr, inner);
+    mu_assert(v && value_int(v) == 11, "Sites should see shadowing bindings");
+    env_delete(inner);
+    v = eval(expr, env);
+    mu_assert(v && value_int(v) == 6, "Sites should forget deleted bindings");
+
+    char unbound[] = "(sum y 0)";
+    Value* y = eval_read(unbound);
+    mu_assert(eval(y, env) == NULL, "Unbound globals should fail");
+    env_set(env, symbol_intern("y"), value_new_int(3));
+    v = eval(y, env);
+    mu_assert(v && value_int(v) == 3, "Later definitions should be found");
+
+    /* A use site that is evaluated in sibling environments */
+    Environment* a = env_new(builtins);
+    Environment* b = env_new(builtins);
+    env_set(a, symbol_intern("x"), value_new_int(1));
+    env_set(b, symbol_intern("x"), value_new_int(100));
+    char call[] = "(sum x 0)";
+    expr = eval_read(call);
+    char let[] = "(let (z 0) x)";
+    Value* body = eval_read(let);
+    for (int i = 0; i < 2; ++i) {
+        v = eval(expr, a);
+        mu_assert(v && value_int(v) == 1, "Sites should resolve in each environment");
+        v = eval(expr, b);
+        mu_assert(v && value_int(v) == 100, "Sites should not reuse a sibling's cell");
+        v = eval(body, a);
+        mu_assert(v && value_int(v) == 1, "Sites in frames should resolve in their scope");
+        v = eval(body, b);
+        mu_assert(v && value_int(v) == 100, "Sites in frames should not reuse a sibling's cell");
+    }
+    env_delete(b);
+    env_delete(a);
+
+    env_delete(env);
+    env_delete(builtins);
+    return 0;
+}
+
+static char* test_eval_snapshot()
+{
+    Environment* env = env_new(NULL);
+    env_set(env, symbol_intern("sum"), value_new_fn(core_sum));
+    env_set(env, symbol_intern("x"), value_new_int(1));
+    char call[] = "(sum x 0)";
+    Value* expr = eval_read(call);
+    char let[] = "(let (z 0) x)";
+    Value* body = eval_read(let);
+    Value* v = eval(expr, env);
+    mu_assert(v && value_int(v) == 1, "Globals should resolve");
+
+    Environment* snap = env_snapshot(env);
+    env_set(env, symbol_intern("x"), value_new_int(2));
+    for (int i = 0; i < 2; ++i) {
+        v = eval(expr, env);
+        mu_assert(v && value_int(v) == 2, "Sites should see redefinitions");
+        v = eval(expr, snap);
+        mu_assert(v && value_int(v) == 1, "Sites should see the snapshot as it was");
+        v = eval(body, snap);
+        mu_assert(v && value_int(v) == 1, "Sites in frames should see the snapshot as it was");
+        v = eval(body, env);
+        mu_assert(v && value_int(v) == 2, "Sites in frames should see redefinitions");
+    }
+    env_delete(env);
+    return 0;
+}
+
+static char* test_eval_strings()
+{
+    Environment* env = env_new(NULL);
+    env_set(env, symbol_intern("count"), value_new_fn(core_count));
+    env_set(env, symbol_intern("subs"), value_new_fn(core_subs));
+
+    char subs[] = "(subs \"hello, world\" 7)";
+    Value* v = eval_string(subs, env);
+    mu_assert(v && value_equal(v, value_new_string("world")), "Subs should slice to the end");
+    mu_assert(v->value.string->base != NULL, "Subs should not copy");
+
+    char count[] = "(count (subs \"hello, world\" 1 5))";
+    v = eval_string(count, env);
+    mu_assert(v && value_int(v) == 4, "Count should find the length of a slice");
+
+    char outside[] = "(subs \"hello\" 2 9)";
+    mu_assert(eval_string(outside, env) == NULL, "Subs should reject indices past the end");
+    return NULL;
+}
@@ -26,14 +26,13 @@ void dtor(void* ptr)
 static char* test_gc_allocation_new_delete()
 {
     int* ptr = malloc(sizeof(int));
-    Allocation* a = gc_allocation_new(ptr, sizeof(int), dtor);
+    Allocation* a = gc_allocation_new(NULL, ptr, sizeof(int), dtor);
     mu_assert(a != NULL, "Allocation should return non-NULL");
     mu_assert(a->ptr == ptr, "Allocation should contain original pointer");
     mu_assert(a->size == sizeof(int), "Size of mem pointed to should not change");
     mu_assert(a->tag == GC_TAG_NONE, "Annotation should initially be untagged");
     mu_assert(a->dtor == dtor, "Destructor pointer should not change");
-    mu_assert(a->next == NULL, "Annotation should initilally be unlinked");
-    gc_allocation_delete(a);
+    gc_allocation_delete(NULL, a);
     free(ptr);
     return NULL;
 }
@@ -42,25 +41,27 @@ static char* test_gc_allocation_new_delete()
 static char* test_gc_allocation_map_new_delete()
 {
     /* Standard invocation */
-    AllocationMap* am = gc_allocation_map_new(8, 16, 0.5, 0.2, 0.8);
-    mu_assert(am->min_capacity == 11, "True min capacity should be next prime");
-    mu_assert(am->capacity == 17, "True capacity should be next prime");
+    AllocationMap* am = gc_allocation_map_new(NULL, 8, 32, 0.5, 0.2, 0.8);
+    mu_assert(am->min_capacity == 16, "True min capacity should be a full group");
+    mu_assert(am->allocs.capacity == 32, "True capacity should be a power of 2");
     mu_assert(am->size == 0, "Allocation map should be initialized to empty");
-    mu_assert(am->sweep_limit == 8, "Incorrect sweep limit calculation");
+    mu_assert(am->sweep_limit == 16, "Incorrect sweep limit calculation");
+    mu_assert(am->upsize_limit == 25, "Upsize limit should round the load down");
+    mu_assert(am->downsize_limit == 7, "Downsize limit should round the load up");
     mu_assert(am->downsize_factor == 0.2, "Downsize factor should not change");
     mu_assert(am->upsize_factor == 0.8, "Upsize factor should not change");
-    mu_assert(am->allocs != NULL, "Allocation map must not have a NULL pointer");
+    mu_assert(am->allocs.ctrl != NULL, "Allocation map must not have a NULL pointer");
     gc_allocation_map_delete(am);
 
     /* Enforce min sizes */
-    am = gc_allocation_map_new(8, 4, 0.5, 0.2, 0.8);
-    mu_assert(am->min_capacity == 11, "True min capacity should be next prime");
-    mu_assert(am->capacity == 11, "True capacity should be next prime");
+    am = gc_allocation_map_new(NULL, 8, 4, 0.5, 0.2, 0.8);
+    mu_assert(am->min_capacity == 16, "True min capacity should be a full group");
+    mu_assert(am->allocs.capacity == 16, "Capacity must not drop below min capacity");
     mu_assert(am->size == 0, "Allocation map should be initialized to empty");
-    mu_assert(am->sweep_limit == 5, "Incorrect sweep limit calculation");
+    mu_assert(am->sweep_limit == 8, "Incorrect sweep limit calculation");
     mu_assert(am->downsize_factor == 0.2, "Downsize factor should not change");
     mu_assert(am->upsize_factor == 0.8, "Upsize factor should not change");
-    mu_assert(am->allocs != NULL, "Allocation map must not have a NULL pointer");
+    mu_assert(am->allocs.ctrl != NULL, "Allocation map must not have a NULL pointer");
     gc_allocation_map_delete(am);
 
     return NULL;
@@ -69,7 +70,7 @@ static char* test_gc_allocation_map_new_delete()
 
 static char* test_gc_allocation_map_basic_get()
 {
-    AllocationMap* am = gc_allocation_map_new(8, 16, 0.5, 0.2, 0.8);
+    AllocationMap* am = gc_allocation_map_new(NULL, 8, 16, 0.5, 0.2, 0.8);
 
     /* Ask for something that does not exist */
     int* five = malloc(sizeof(int));
@@ -81,7 +82,7 @@ static char* test_gc_allocation_map_basic_get()
     a = gc_allocation_map_put(am, five, sizeof(int), NULL);
     mu_assert(a != NULL, "Result of PUT on allocation map must be non-NULL");
     mu_assert(am->size == 1, "Expect size of one-element map to be one");
-    mu_assert(am->allocs != NULL, "AllocationMap must hold list of allocations");
+    mu_assert(am->allocs.ctrl != NULL, "AllocationMap must hold slots for allocations");
     Allocation* b = gc_allocation_map_get(am, five);
     mu_assert(a == b, "Get should return the same result as put");
     mu_assert(a->ptr == b->ptr, "Pointers must not change between calls");
@@ -112,16 +113,17 @@ static char* test_gc_allocation_map_put_get_remove()
         ints[i] = malloc(sizeof(int));
     }
 
-    /* Enforce separate chaining by disallowing up/downsizing.
-     * The pigeonhole principle then states that we need to have at least one
-     * entry in the hash map that has a separare chain with len > 1
+    /* Disallow up/downsizing by load factor. Open addressing cannot hold
+     * more entries than slots, so the map must still grow once it runs
+     * out of empty slots.
      */
-    AllocationMap* am = gc_allocation_map_new(32, 32, 1.1, 0.0, 1.1);
+    AllocationMap* am = gc_allocation_map_new(NULL, 32, 32, 1.1, 0.0, 1.1);
     Allocation* a;
     for (size_t i=0; i<64; ++i) {
         a = gc_allocation_map_put(am, ints[i], sizeof(int), NULL);
     }
     mu_assert(am->size == 64, "Maps w/ 64 elements should have size 64");
+    mu_assert(am->allocs.capacity > 64, "Full maps must grow");
     /* Now update all of them with a new dtor */
     for (size_t i=0; i<64; ++i) {
         a = gc_allocation_map_put(am, ints[i], sizeof(int), dtor);
@@ -148,7 +150,7 @@ static char* test_gc_mark_stack()
 {
     GarbageCollector gc_;
     int bos;
-    gc_start_ext(&gc_, &bos, 32, 32, 0.0, 1.1, 1.1);
+    gc_start_ext(&gc_, &bos, 32, 32, 0.0, 1.1, 1.1, NULL);
     gc_pause(&gc_);
 
     /* Part 1: Create an object on the heap, reference from the stack,
@@ -206,7 +208,7 @@ static char* test_gc_basic_alloc_free()
      */
     GarbageCollector gc_;
     int bos;
-    gc_start_ext(&gc_, &bos, 32, 32, 0.0, 1.1, 1.1);
+    gc_start_ext(&gc_, &bos, 32, 32, 0.0, 1.1, 1.1, NULL);
 
     int** ints = gc_calloc(&gc_, 16, sizeof(int*));
     Allocation* a = gc_allocation_map_get(gc_.allocs, ints);
@@ -220,14 +222,13 @@ static char* test_gc_basic_alloc_free()
 
     /* Test that all managed allocations get tagged if the root is present */
     gc_mark(&gc_);
-    for (size_t i=0; i<gc_.allocs->capacity; ++i) {
-        Allocation* chunk = gc_.allocs->allocs[i];
-        while (chunk) {
+    for (size_t i=0; i<gc_.allocs->allocs.capacity; ++i) {
+        if (gc_slots_full(&gc_.allocs->allocs, i)) {
+            Allocation* chunk = gc_.allocs->allocs.slots[i];
             // LOG_INFO("Allocation @ %p has tags %u", chunk, chunk->tag);
             mu_assert(chunk->tag & GC_TAG_MARK, "Referenced allocs should be marked");
             // reset for next test
             chunk->tag = GC_TAG_NONE;
-            chunk = chunk->next;
         }
     }
 
@@ -237,13 +238,12 @@ static char* test_gc_basic_alloc_free()
 
     /* Check that none of the allocations get tagged */
     size_t total = 0;
-    for (size_t i=0; i<gc_.allocs->capacity; ++i) {
-        Allocation* chunk = gc_.allocs->allocs[i];
-        while (chunk) {
+    for (size_t i=0; i<gc_.allocs->allocs.capacity; ++i) {
+        if (gc_slots_full(&gc_.allocs->allocs, i)) {
+            Allocation* chunk = gc_.allocs->allocs.slots[i];
             // LOG_INFO("Allocation @ %p has tags %u", chunk, chunk->tag);
             mu_assert(!(chunk->tag & GC_TAG_MARK), "Unreferenced allocs should not be marked");
             total += chunk->size;
-            chunk = chunk->next;
         }
     }
     mu_assert(total == 16 * sizeof(int) + 16 * sizeof(int*),
@@ -253,3 +253,197 @@ static char* test_gc_basic_alloc_free()
     mu_assert(n == total, "Wrong number of collected bytes");
     return NULL;
 }
+
+
+static void profile_totals(GcProfile* prof, size_t* alloc_bytes,
+                           size_t* live_bytes, size_t* survivals)
+{
+    *alloc_bytes = *live_bytes = *survivals = 0;
+    for (size_t i=0; i<GC_PROFILE_BUCKETS; ++i) {
+        for (GcProfileSite* site = prof->sites[i]; site; site = site->next) {
+            *alloc_bytes += site->alloc_bytes;
+            *live_bytes += site->live_bytes;
+            *survivals += site->survivals;
+        }
+    }
+}
+
+
+static char* test_gc_profile()
+{
+    GarbageCollector gc_;
+    int bos;
+    size_t alloc_bytes, live_bytes, survivals;
+    gc_start_ext(&gc_, &bos, 32, 32, 0.0, 1.1, 1.1, NULL);
+
+    /* A sample interval of one byte samples every single allocation */
+    gc_profile_start(&gc_, 1);
+    int** ints = gc_calloc(&gc_, 4, sizeof(int*));
+    for (size_t i=0; i<4; ++i) {
+        ints[i] = gc_malloc(&gc_, sizeof(int));
+    }
+    size_t expected = 4 * sizeof(int*) + 4 * sizeof(int);
+    profile_totals(gc_.profile, &alloc_bytes, &live_bytes, &survivals);
+    mu_assert(alloc_bytes == expected, "All allocated bytes should be sampled");
+    mu_assert(live_bytes == expected, "All sampled bytes should be live");
+    mu_assert(survivals == 0, "Nothing can survive before the first collection");
+
+    /* Rooted allocations (and everything they reference) survive a run */
+    Allocation* a = gc_allocation_map_get(gc_.allocs, ints);
+    a->tag |= GC_TAG_ROOT;
+    gc_run(&gc_);
+    profile_totals(gc_.profile, &alloc_bytes, &live_bytes, &survivals);
+    mu_assert(survivals == 5, "Each sampled allocation should survive once");
+    mu_assert(live_bytes == expected, "Surviving allocations must stay live");
+
+    /* Explicitly freed allocations are no longer live */
+    gc_free(&gc_, ints[0]);
+    profile_totals(gc_.profile, &alloc_bytes, &live_bytes, &survivals);
+    mu_assert(alloc_bytes == expected, "Freeing must not change allocated bytes");
+    mu_assert(live_bytes == expected - sizeof(int), "Freed bytes must not be live");
+
+    /* Dumps produce one folded stack per site */
+    FILE* out = tmpfile();
+    size_t lines = gc_profile_dump(&gc_, out, GC_PROFILE_ALLOC_BYTES);
+    mu_assert(lines > 0, "Profile dump should contain at least one site");
+    mu_assert(ftell(out) > 0, "Profile dump should write to the stream");
+    fclose(out);
+
+    gc_profile_stop(&gc_);
+    mu_assert(gc_.profile == NULL, "Stopping the profiler should detach it");
+    a->tag = GC_TAG_NONE;
+    gc_stop(&gc_);
+    return NULL;
+}
+
+
+static char* test_gc_trace()
+{
+    GarbageCollector gc_;
+    int bos;
+    gc_start_ext(&gc_, &bos, 32, 32, 0.0, 1.1, 1.1, NULL);
+
+    FILE* out = tmpfile();
+    mu_assert(gc_trace_start(&gc_, out), "Tracing should start");
+    mu_assert(!gc_trace_start(&gc_, out), "Tracing must not start twice");
+    void* a = gc_malloc(&gc_, 200);
+    void* b = gc_calloc(&gc_, 4, 8);
+    a = gc_realloc(&gc_, a, 16);
+    gc_free(&gc_, b);
+    gc_free(&gc_, a);
+    gc_trace_stop(&gc_);
+    mu_assert(gc_.trace == NULL, "Stopping the trace should detach it");
+
+    unsigned char expected[] = {
+        GC_TRACE_MALLOC, 0xc8, 0x01,    // id 1, 200 bytes (two byte varint)
+        GC_TRACE_CALLOC, 4, 8,          // id 2
+        GC_TRACE_REALLOC, 2, 16,        // id 1 -> id 3
+        GC_TRACE_FREE, 1,               // id 2
+        GC_TRACE_FREE, 0                // id 3
+    };
+    size_t magic_len = strlen(GC_TRACE_MAGIC);
+    char buf[64];
+    rewind(out);
+    size_t n = fread(buf, 1, sizeof(buf), out);
+    fclose(out);
+    mu_assert(n == magic_len + sizeof(expected), "Unexpected trace length");
+    mu_assert(memcmp(buf, GC_TRACE_MAGIC, magic_len) == 0, "Trace must start with magic");
+    mu_assert(memcmp(buf + magic_len, expected, sizeof(expected)) == 0,
+              "Unexpected trace contents");
+    gc_stop(&gc_);
+    return NULL;
+}
+
+
+static size_t on_run_calls = 0;
+
+static void count_runs(GarbageCollector* gc)
+{
+    (void) gc;
+    on_run_calls++;
+}
+
+static char* test_gc_stats()
+{
+    GarbageCollector gc_;
+    int bos;
+    gc_start_ext(&gc_, &bos, 32, 32, 0.0, 1.1, 1.1, NULL);
+    mu_assert(gc_.stats.runs == 0, "A new collector has not run yet");
+    mu_assert(gc_.stats.total_pause_ns == 0, "A new collector has not paused yet");
+
+    gc_.on_run = count_runs;
+    gc_run(&gc_);
+    gc_run(&gc_);
+    mu_assert(gc_.stats.runs == 2, "Each run should be counted");
+    mu_assert(on_run_calls == 2, "The run hook should be called after each run");
+    mu_assert(gc_.stats.total_pause_ns >= gc_.stats.last_pause_ns,
+              "Total pause time must include the last pause");
+    gc_stop(&gc_);
+    return NULL;
+}
+
+
+static char* test_gc_heap()
+{
+    Heap* heap = heap_new(1 << 20, 0, -1);
+    GarbageCollector gc_;
+    int bos;
+    gc_start_ext(&gc_, &bos, 32, 32, 0.0, 1.1, 1.1, heap);
+
+    int** ints = gc_calloc(&gc_, 16, sizeof(int*));
+    mu_assert(heap_contains(heap, ints), "Objects should come from the heap");
+    for (size_t i=0; i<16; ++i) {
+        mu_assert(ints[i] == NULL, "Calloc'd heap memory must be zeroed");
+        ints[i] = gc_malloc(&gc_, sizeof(int));
+    }
+    mu_assert(heap->used == 16 * 16 + 128, "Heap should hold all objects");
+    ints = gc_realloc(&gc_, ints, 32 * sizeof(int*));
+    mu_assert(heap_contains(heap, ints), "Reallocated objects stay in the heap");
+
+    /* Pointers outside of the heap are never looked up */
+    int on_stack;
+    gc_mark_alloc(&gc_, &on_stack);
+    gc_free(&gc_, ints);
+    gc_stop(&gc_);
+    mu_assert(heap->used == 0, "Collected objects must be returned to the heap");
+    heap_delete(heap);
+    return NULL;
+}
+
+
+static char* test_gc_fixed_heap()
+{
+    static char block[64 * 1024];
+    Heap* heap = heap_new_static(block, sizeof(block));
+    GarbageCollector gc_;
+    int bos;
+    gc_start_ext(&gc_, &bos, 32, 32, 0.0, 0.8, 1.1, heap);
+    mu_assert(heap_contains(heap, gc_.allocs) && heap_contains(heap, gc_.allocs->allocs.ctrl),
+              "Allocation map should live in the fixed heap");
+
+    void** slots = gc_make_root(&gc_, gc_calloc(&gc_, 128, sizeof(void*)));
+    size_t n = 0;
+    while (n < 128 && (slots[n] = gc_malloc(&gc_, 1024))) {
+        n++;
+    }
+    mu_assert(n > 0 && n < 128, "Fixed heap should run out of memory");
+    mu_assert(errno == ENOMEM, "Exhaustion should be reported as ENOMEM");
+    Allocation* a = gc_allocation_map_get(gc_.allocs, slots[0]);
+    mu_assert(heap_contains(heap, a), "Allocation metadata should live in the fixed heap");
+
+    /* Exhaustion is recoverable once objects become unreachable */
+    for (size_t i = 0; i < n; i += 2) {
+        slots[i] = NULL;
+    }
+    mu_assert((slots[0] = gc_malloc(&gc_, 1024)) != NULL,
+              "Allocation should succeed after a collection");
+
+    for (size_t i = 0; i < n; ++i) {
+        gc_free(&gc_, slots[i]);
+    }
+    gc_free(&gc_, slots);
+    gc_stop(&gc_);
+    mu_assert(heap->used == 0, "Objects and metadata must be returned to the fixed heap");
+    heap_delete(heap);
+    return NULL;
+}
@@ -0,0 +1,87 @@
+/*
+ * test_hamt.c
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "minunit.h"
+#include "hamt.h"
+#include "value.h"
+
+static char* test_hamt()
+{
+    Hamt* empty = hamt_new();
+    Value* one = value_new_int(1);
+    Value* key = value_new_string("key");
+    mu_assert(hamt_size(empty) == 0, "New map should be empty");
+    mu_assert(hamt_get(empty, key) == NULL, "New map should not find keys");
+
+    /* assoc/get, older versions stay untouched */
+    Hamt* m1 = hamt_assoc(empty, key, one);
+    mu_assert(hamt_size(m1) == 1, "Assoc should add an entry");
+    mu_assert(hamt_get(m1, value_new_string("key")) == one, "Get should find keys by value");
+    mu_assert(hamt_get(empty, key) == NULL, "Assoc must not change the old map");
+    mu_assert(hamt_assoc(m1, key, one) == m1, "Assoc of an equal entry should be a no-op");
+    Hamt* m2 = hamt_assoc(m1, key, value_new_int(2));
+    mu_assert(hamt_size(m2) == 1, "Assoc of a known key should replace its value");
+    mu_assert(value_int(hamt_get(m2, key)) == 2, "Get should find replaced values");
+    mu_assert(hamt_get(m1, key) == one, "Replacing a value must not change the old map");
+
+    /* Grow deep enough to need sub-nodes */
+    Hamt* big = empty;
+    for (int i = 0; i < 100; ++i) {
+        big = hamt_assoc(big, value_new_int(i), value_new_int(2 * i));
+    }
+    mu_assert(hamt_size(big) == 100, "Map should hold all entries");
+    for (int i = 0; i < 100; ++i) {
+        Value* v = hamt_get(big, value_new_int(i));
+        mu_assert(v && value_int(v) == 2 * i, "Get should find all entries");
+    }
+    size_t count = 0;
+    long total = 0;
+    HamtIter it;
+    Value* k;
+    Value* v;
+    hamt_iter_init(&it, big);
+    while (hamt_iter_next(&it, &k, &v)) {
+        count++;
+        total += value_int(v);
+    }
+    mu_assert(count == 100, "Iteration should visit every entry once");
+    mu_assert(total == 99L * 100, "Iteration should yield every value");
+
+    /* Equality does not depend on the order of updates */
+    Hamt* reversed = empty;
+    for (int i = 99; i >= 0; --i) {
+        reversed = hamt_assoc(reversed, value_new_int(i), value_new_int(2 * i));
+    }
+    mu_assert(hamt_equal(big, reversed), "Maps with equal entries should be equal");
+    mu_assert(hamt_hash(big) == hamt_hash(reversed), "Equal maps should hash alike");
+    Hamt* changed = hamt_assoc(big, value_new_int(42), value_new_int(0));
+    mu_assert(!hamt_equal(big, changed), "Maps with different values must differ");
+    mu_assert(value_int(hamt_get(big, value_new_int(42))) == 84, "Old map must not change");
+
+    /* dissoc all the way back to the empty map */
+    Hamt* shrunk = big;
+    for (int i = 0; i < 100; i += 2) {
+        shrunk = hamt_dissoc(shrunk, value_new_int(i));
+    }
+    mu_assert(hamt_size(shrunk) == 50, "Dissoc should remove entries");
+    mu_assert(hamt_get(shrunk, value_new_int(2)) == NULL, "Get must not find removed keys");
+    mu_assert(value_int(hamt_get(shrunk, value_new_int(3))) == 6, "Dissoc should keep others");
+    mu_assert(hamt_dissoc(shrunk, value_new_int(2)) == shrunk, "Dissoc of unknown key is a no-op");
+    mu_assert(hamt_size(big) == 100, "Dissoc must not change the old map");
+    for (int i = 1; i < 100; i += 2) {
+        shrunk = hamt_dissoc(shrunk, value_new_int(i));
+    }
+    mu_assert(hamt_size(shrunk) == 0, "Map should be empty again");
+    mu_assert(hamt_equal(shrunk, empty), "Emptied map should equal the empty map");
+
+    /* Maps as values */
+    Value* a = value_new_map(m1);
+    Value* b = value_new_map(hamt_assoc(empty, value_new_string("key"), value_new_int(1)));
+    mu_assert(value_equal(a, b), "Map values should compare by content");
+    mu_assert(value_hash(a) == value_hash(b), "Equal map values should hash alike");
+    return 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * test_hash.c
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "hash.h"
+#include "minunit.h"
+
+
+static char* test_hash()
+{
+    /* the hash only depends on the bytes, not on where they are */
+    char buf[128 + 8];
+    const char* text = "The quick brown fox jumps over the lazy dog, "
+                       "then over the lazy cat and finally over the fence.";
+    size_t len = strlen(text);
+    for (size_t offset = 0; offset < 8; ++offset) {
+        memcpy(buf + offset, text, len);
+        mu_assert(hash_bytes(buf + offset, len, 1) == hash_bytes(text, len, 1),
+                  "Hash should not depend on alignment");
+    }
+    /* every prefix hashes differently, across all length classes */
+    uint64_t hashes[100];
+    for (size_t i = 0; i < len; ++i) {
+        hashes[i] = hash_bytes(text, i, HASH_SEED);
+        for (size_t j = 0; j < i; ++j) {
+            mu_assert(hashes[i] != hashes[j], "Prefixes should hash differently");
+        }
+    }
+    mu_assert(hash_bytes(text, len, 1) != hash_bytes(text, len, 2),
+              "Seeds should change the hash");
+    mu_assert(hash_bytes("a", 1, 0) != hash_bytes("b", 1, 0),
+              "Single bytes should hash differently");
+    mu_assert(hash_string("sum", 3) == hash_string("sum", 3), "Hash should be deterministic");
+    mu_assert(hash_string(text, 3) == hash_string("The", 3), "Hash should stop after len bytes");
+    return 0;
+}
+
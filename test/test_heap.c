@@ -0,0 +1,85 @@
+/*
+ * test_heap.c
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "minunit.h"
+#include "heap.h"
+
+static char* test_heap()
+{
+    Heap* heap = heap_new(1 << 20, 0, -1);
+    mu_assert(heap != NULL, "Heap reservation should succeed");
+    mu_assert(heap->limit - heap->base == 1 << 20, "Heap should have the requested size");
+
+    /* Size classes */
+    mu_assert(heap_chunk_size(1) == 16, "Tiny objects should use 16 byte chunks");
+    mu_assert(heap_chunk_size(17) == 32, "Small objects should round to 16 bytes");
+    mu_assert(heap_chunk_size(300) == 512, "Medium objects should round to powers of 2");
+    mu_assert(heap_chunk_size(40000) == 40960, "Large objects should round to pages");
+
+    /* Objects are aligned and live inside the heap */
+    char* a = heap_alloc(heap, 24);
+    char* b = heap_alloc(heap, 24);
+    mu_assert(heap_contains(heap, a) && heap_contains(heap, b), "Objects must be in the heap");
+    mu_assert(((size_t) a % HEAP_ALIGN) == 0, "Objects must be aligned");
+    mu_assert(b - a == 32, "Same-class objects should be packed");
+    mu_assert(heap->used == 64, "Heap should account for the chunks it handed out");
+
+    /* Freed chunks are reused by their class */
+    heap_free(heap, a, 24);
+    mu_assert(heap_alloc(heap, 30) == a, "Freed chunk should be reused");
+
+    /* Large spans coalesce and return to the bump region */
+    char* top = heap->top;
+    char* x = heap_alloc(heap, 40000);
+    char* y = heap_alloc(heap, 40000);
+    mu_assert(y - x == 40960, "Large objects should be page-sized");
+    heap_free(heap, x, 40000);
+    mu_assert(heap_alloc(heap, 33000) == x, "Freed span should be reused");
+    heap_free(heap, x, 33000);
+    heap_free(heap, y, 40000);
+    mu_assert(heap->spans == NULL, "Trailing spans should return to the bump region");
+    mu_assert(heap->top == top, "Bump pointer should move back");
+
+    /* Growing a chunk within its class keeps it in place */
+    mu_assert(heap_realloc(heap, b, 24, 32) == b, "Realloc within a class must not move");
+    char* c = heap_realloc(heap, b, 32, 100);
+    mu_assert(c != b, "Realloc across classes should move");
+
+    /* Exhaustion is reported, not fatal */
+    mu_assert(heap_alloc(heap, 2 << 20) == NULL, "Exhausted heap must return NULL");
+
+    heap_delete(heap);
+
+    /* Huge page reservations are aligned to huge pages */
+    heap = heap_new(1, HEAP_HUGE_PAGES, -1);
+    mu_assert(heap != NULL, "Huge page reservation should succeed");
+    mu_assert(((size_t) heap->base % HEAP_HUGE_PAGE) == 0, "Huge page heap must be aligned");
+    heap_delete(heap);
+    return 0;
+}
+
+static char* test_heap_static()
+{
+    static char block[4096];
+    Heap* heap = heap_new_static(block + 1, sizeof(block) - 1);
+    mu_assert(heap != NULL, "Fixed heap should fit into the block");
+    mu_assert((char*) heap >= block && heap->limit <= block + sizeof(block),
+              "Fixed heap must stay within the block");
+    mu_assert(((size_t) heap->base % HEAP_ALIGN) == 0, "Fixed heap must be aligned");
+    mu_assert(heap->flags & HEAP_FIXED, "Fixed heap should be flagged");
+
+    /* The block is the hard limit */
+    size_t n = 0;
+    while (heap_alloc(heap, 64)) n++;
+    mu_assert(n == (size_t) (heap->limit - heap->base) / 64, "Fixed heap should fill up");
+    mu_assert(heap_alloc(heap, 1) == NULL, "Exhausted fixed heap must return NULL");
+    heap_delete(heap);
+
+    mu_assert(heap_new_static(block, sizeof(Heap) / 2) == NULL,
+              "Fixed heap must not exceed its block");
+    return 0;
+}
@@ -9,6 +9,7 @@
 #include <string.h>
 #include "minunit.h"
 #include "ir.h"
+#include "reader.h"
 
 static char* test_ir()
 {
@@ -48,3 +49,47 @@ static char* test_ir()
     printf("\n");
     return 0;
 }
+
+static Value* ir_read(char* input)
+{
+    FILE* stream = fmemopen(input, strlen(input), "r");
+    Reader* reader = reader_new(stream);
+    AstSexpr* ast = reader_read(reader);
+    reader_delete(reader);
+    Value* ir = ir_from_ast(ast);
+    ast_delete_sexpr(ast);
+    return ir;
+}
+
+static char* test_ir_resolve()
+{
+    // (let (x 1 y x) (lambda (z x) (sum x y z w)))
+    char input[] = "(let (x 1 y x) (lambda (z x) (sum x y z w)))";
+    Value* ir = ir_resolve(ir_read(input));
+    mu_assert(ir != NULL, "Should resolve well-formed forms");
+    List* let = ir->value.list;
+    List* bindings = ((Value*) list_head(list_tail(let)))->value.list;
+    Value* init = list_head(list_tail(list_tail(list_tail(bindings))));
+    mu_assert(value_type(init) == VALUE_GLOBAL, "Inits should resolve in the enclosing scope");
+    Value* lambda = list_head(list_tail(list_tail(let)));
+    List* call = ((Value*) list_head(list_tail(list_tail(lambda->value.list))))->value.list;
+    Value* sum = list_head(call);
+    mu_assert(value_type(sum) == VALUE_GLOBAL && sum->value.global.symbol == symbol_intern("sum"),
+              "Free variables should become globals");
+    Value* x = list_head(list_tail(call));
+    mu_assert(value_type(x) == VALUE_LOCAL && x->value.local.depth == 0 && x->value.local.slot == 1,
+              "Parameters should shadow outer variables");
+    Value* y = list_head(list_tail(list_tail(call)));
+    mu_assert(value_type(y) == VALUE_LOCAL && y->value.local.depth == 1 && y->value.local.slot == 1,
+              "Outer variables should resolve to enclosing frames");
+    Value* z = list_head(list_tail(list_tail(list_tail(call))));
+    mu_assert(value_type(z) == VALUE_LOCAL && z->value.local.depth == 0 && z->value.local.slot == 0,
+              "Parameters should resolve to their slots");
+    Value* w = list_head(list_tail(list_tail(list_tail(list_tail(call)))));
+    mu_assert(value_type(w) == VALUE_GLOBAL && w->value.global.cell == NULL,
+              "Unbound variables should become globals");
+
+    char malformed[] = "(let (x) x)";
+    mu_assert(ir_resolve(ir_read(malformed)) == NULL, "Should reject malformed bindings");
+    return 0;
+}
@@ -7,35 +7,224 @@
 
 #include "minunit.h"
 
+#include <stdio.h>
 #include <string.h>
 #include "gc.h"
 #include "map.h"
 #include "log.h"
 
+static int* map_int(int i)
+{
+    int* p = gc_malloc(&gc, sizeof(int));
+    *p = i;
+    return p;
+}
 
 static char* test_map()
 {
     Map* ht = map_new(3);
-    LOG_DEBUG("Capacity: %lu", ht->capacity);
-    mu_assert(ht->capacity == 3, "Capacity sizing failure");
-    map_put(ht, "key", "value", strlen("value") + 1);
+    LOG_DEBUG("Capacity: %lu", ht->slots.capacity);
+    mu_assert(ht->slots.capacity == 0, "Small maps must not allocate slots");
+    Symbol* key = symbol_intern("key");
+    char first[] = "value";
+    map_put(ht, key, first);
     // set/get item
-    char* value = (char*) map_get(ht, "key");
+    char* value = (char*) map_get(ht, key);
     mu_assert(value != NULL, "Query must find inserted key");
     mu_assert(strcmp(value, "value") == 0, "Query must return inserted value");
+    mu_assert(value == first, "Map must hold values, not copies");
 
     // update item
-    map_put(ht, "key", "other", strlen("other") + 1);
-    value = (char*) map_get(ht, "key");
+    void** cell = map_get_cell(ht, key);
+    map_put(ht, key, "other");
+    value = (char*) map_get(ht, key);
     mu_assert(value != NULL, "Query must find key");
     mu_assert(strcmp(value, "other") == 0, "Query must return updated value");
+    mu_assert(map_get_cell(ht, key) == cell && *cell == value, "Update must keep the cell");
 
     // delete item
-    map_remove(ht, "key");
-    value = (char*) map_get(ht, "key");
+    map_remove(ht, key);
+    value = (char*) map_get(ht, key);
     mu_assert(value == NULL, "Query must NOT find deleted key");
 
     map_delete(ht);
     return 0;
 }
 
+
+static char* test_map_grow()
+{
+    Map* ht = map_new(0);
+    char key[16];
+    for (int i = 0; i < 1000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        map_put(ht, symbol_intern(key), map_int(i));
+    }
+    mu_assert(ht->size == 1000, "Map must hold all inserted keys");
+    mu_assert(ht->size <= ht->slots.capacity - ht->slots.capacity / 8,
+              "Map must keep its load factor");
+    for (int i = 0; i < 1000; i += 2) {
+        snprintf(key, sizeof(key), "k%d", i);
+        map_remove(ht, symbol_intern(key));
+    }
+    mu_assert(ht->size == 500, "Map must drop removed keys");
+    for (int i = 0; i < 1000; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        int* value = map_get(ht, symbol_intern(key));
+        if (i % 2) {
+            mu_assert(value && *value == i, "Query must find remaining keys");
+        } else {
+            mu_assert(value == NULL, "Query must NOT find removed keys");
+        }
+    }
+    /* Churn through deleted slots without growing */
+    size_t capacity = ht->slots.capacity;
+    for (int i = 0; i < 10000; ++i) {
+        snprintf(key, sizeof(key), "t%d", i);
+        map_put(ht, symbol_intern(key), map_int(i));
+        map_remove(ht, symbol_intern(key));
+    }
+    mu_assert(ht->slots.capacity == capacity, "Deleted slots must be reclaimed");
+    mu_assert(*(int*) map_get(ht, symbol_intern("k999")) == 999, "Query must survive rehashing");
+    map_delete(ht);
+    return 0;
+}
+
+static char* test_map_small()
+{
+    Map* ht = map_new(0);
+    char key[16];
+    for (int i = 0; i < MAP_SMALL_SIZE; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        map_put(ht, symbol_intern(key), map_int(i));
+    }
+    mu_assert(ht->slots.capacity == 0, "Map must stay small up to MAP_SMALL_SIZE entries");
+    map_remove(ht, symbol_intern("k0"));
+    mu_assert(map_get(ht, symbol_intern("k0")) == NULL, "Query must NOT find removed keys");
+    mu_assert(*(int*) map_get(ht, symbol_intern("k7")) == 7, "Remove must keep other keys");
+    int i = 0;
+    map_put(ht, symbol_intern("k0"), map_int(i));
+    mu_assert(ht->slots.capacity == 0, "Removed entries must make room");
+    i = MAP_SMALL_SIZE;
+    snprintf(key, sizeof(key), "k%d", i);
+    map_put(ht, symbol_intern(key), map_int(i));
+    mu_assert(ht->slots.capacity == MAP_GROUP_SIZE, "Map must switch to slots when it outgrows");
+    for (int j = 0; j <= MAP_SMALL_SIZE; ++j) {
+        snprintf(key, sizeof(key), "k%d", j);
+        int* value = map_get(ht, symbol_intern(key));
+        mu_assert(value && *value == j, "Query must find all keys after the switch");
+    }
+    map_delete(ht);
+    return 0;
+}
+
+static char* test_map_get_many()
+{
+    Symbol* keys[20];
+    void* values[20];
+    char key[16];
+    Map* ht = map_new(0);
+    for (int i = 0; i < 20; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        keys[i] = symbol_intern(key);
+        if (i % 2) {
+            map_put(ht, keys[i], map_int(i));
+        }
+    }
+    mu_assert(map_get_many(ht, keys, values, 20) == 10, "Batch must find all present keys");
+    for (int i = 0; i < 20; ++i) {
+        if (i % 2) {
+            mu_assert(values[i] && *(int*) values[i] == i, "Batch must return the values");
+        } else {
+            mu_assert(values[i] == NULL, "Batch must NOT find missing keys");
+        }
+    }
+    map_delete(ht);
+    return 0;
+}
+
+static char* test_map_freeze()
+{
+    Map* ht = map_new(0);
+    char key[16];
+    for (int i = 0; i < 300; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        map_put(ht, symbol_intern(key), map_int(i));
+    }
+    map_freeze(ht);
+    mu_assert(ht->seeds != NULL && ht->slots.capacity == 0, "Map should be frozen");
+    mu_assert(ht->size == 300, "Freezing must keep all entries");
+    for (int i = 0; i < 400; ++i) {
+        snprintf(key, sizeof(key), "k%d", i);
+        int* value = map_get(ht, symbol_intern(key));
+        if (i < 300) {
+            mu_assert(value && *value == i, "Query must find all keys of a frozen map");
+        } else {
+            mu_assert(value == NULL, "Query must NOT find other keys in a frozen map");
+        }
+    }
+    /* writes thaw the map */
+    int i = -1;
+    map_put(ht, symbol_intern("k0"), map_int(i));
+    mu_assert(ht->seeds == NULL, "Put must thaw a frozen map");
+    mu_assert(*(int*) map_get(ht, symbol_intern("k0")) == -1, "Put into a frozen map must update");
+    mu_assert(*(int*) map_get(ht, symbol_intern("k299")) == 299, "Thawing must keep all entries");
+    map_delete(ht);
+
+    /* seeds that do not fit the keys still give a working map */
+    Symbol* keys[3] = { symbol_intern("k1"), symbol_intern("k2"), symbol_intern("k3") };
+    int values[3] = { 1, 2, 3 };
+    void* ptrs[3] = { &values[0], &values[1], &values[2] };
+    uint32_t seeds[1] = { 0 };
+    ht = map_new_frozen(keys, ptrs, 3, seeds, 1);
+    for (int j = 0; j < 3; ++j) {
+        int* value = map_get(ht, keys[j]);
+        mu_assert(value && *value == j + 1, "Query must find all keys of a prebuilt frozen map");
+    }
+    map_remove(ht, symbol_intern("k4"));
+    mu_assert(ht->size == 3, "Removing unknown keys must not thaw");
+    map_remove(ht, keys[0]);
+    mu_assert(ht->size == 2 && map_get(ht, keys[0]) == NULL, "Remove must thaw a frozen map");
+    map_delete(ht);
+    return 0;
+}
+
+static char* test_map_incremental_resize()
+{
+    Map* ht = map_new(100);
+    char key[16];
+    int i = 0;
+    /* Fill up the initial slots until a put starts a resize */
+    while (!ht->old.ctrl) {
+        snprintf(key, sizeof(key), "r%d", i);
+        map_put(ht, symbol_intern(key), map_int(i));
+        i++;
+    }
+    mu_assert(ht->migrated == 0, "Starting a resize must not move any slots");
+    size_t old_capacity = ht->old.capacity;
+    mu_assert(ht->slots.capacity == 2 * old_capacity, "Map should double its capacity");
+    for (int j = 0; j < i; ++j) {
+        snprintf(key, sizeof(key), "r%d", j);
+        int* value = map_get(ht, symbol_intern(key));
+        mu_assert(value && *value == j, "Query must find keys during a resize");
+    }
+
+    /* Every put moves a bounded number of slots */
+    map_put(ht, symbol_intern("r0"), map_int(i));
+    mu_assert(ht->migrated == MAP_MIGRATE_SLOTS, "Put must move a bounded number of slots");
+    mu_assert(*(int*) map_get(ht, symbol_intern("r0")) == i, "Update must win over old slots");
+    map_remove(ht, symbol_intern("r1"));
+    mu_assert(ht->migrated == 2 * MAP_MIGRATE_SLOTS, "Remove must move a bounded number of slots");
+    mu_assert(map_get(ht, symbol_intern("r1")) == NULL, "Query must NOT find removed keys");
+    while (ht->old.ctrl) {
+        map_put(ht, symbol_intern("r0"), map_int(i));
+    }
+    mu_assert(ht->size == (size_t) i - 1, "Migration must keep all entries");
+    for (int j = 2; j < i; ++j) {
+        snprintf(key, sizeof(key), "r%d", j);
+        int* value = map_get(ht, symbol_intern(key));
+        mu_assert(value && *value == j, "Query must find keys after a resize");
+    }
+    map_delete(ht);
+    return 0;
+}
@@ -0,0 +1,45 @@
+/*
+ * test_str.c
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include <string.h>
+#include "minunit.h"
+#include "hash.h"
+#include "str.h"
+
+static char* test_string()
+{
+    char chars[] = "hello, world";
+    String* s = string_new(chars, strlen(chars));
+    mu_assert(s->length == 12, "String must know its length");
+    mu_assert(s->chars != chars && strcmp(s->chars, chars) == 0, "String must own a copy");
+    mu_assert(s->hashed && s->hash == hash_string(chars, 12), "String must be hashed once made");
+
+    String* world = string_slice(s, 7, 12);
+    mu_assert(world->length == 5 && world->chars == s->chars + 7, "Slice must share the buffer");
+    mu_assert(world->base == s, "Slice must keep its string alive");
+    mu_assert(string_slice(s, 0, 12) == s, "Slice of the whole string is the string");
+    mu_assert(string_slice(s, 7, 100)->length == 5, "Slice must stop at the end");
+    mu_assert(string_slice(s, 20, 30)->length == 0, "Slice past the end must be empty");
+
+    String* orl = string_slice(world, 1, 4);
+    mu_assert(orl->base == s && memcmp(orl->chars, "orl", 3) == 0,
+              "Slice of a slice must share the original buffer");
+
+    String* copy = string_new("world", 5);
+    mu_assert(!world->hashed, "Slice must be hashed on demand");
+    mu_assert(string_hash(world) == copy->hash, "Slice must hash like an equal string");
+    String* hello = string_slice(s, 0, 5);
+    mu_assert(string_hash(hello) == string_new("hello", 5)->hash,
+              "Slice must not hash the bytes behind it");
+    mu_assert(string_equal(world, copy), "Slice must equal an equal string");
+    mu_assert(!string_equal(orl, copy), "Strings of different lengths must differ");
+    mu_assert(string_compare(string_slice(s, 0, 4), string_slice(s, 0, 5)) < 0,
+              "A prefix should come first");
+    mu_assert(string_compare(copy, s) > 0, "Strings should order by their bytes");
+    mu_assert(string_compare(world, copy) == 0, "Equal strings should compare equal");
+    return 0;
+}
@@ -12,14 +12,21 @@
 
 #include "test_array.c"
 #include "test_ast.c"
+#include "test_btree.c"
+#include "test_cmap.c"
 #include "test_djb2.c"
 #include "test_env.c"
+#include "test_eval.c"
 #include "test_gc.c"
+#include "test_hamt.c"
+#include "test_hash.c"
+#include "test_heap.c"
 #include "test_ir.c"
 #include "test_lexer.c"
 #include "test_list.c"
 #include "test_map.c"
-#include "test_primes.c"
+#include "test_str.c"
+#include "test_symbol.c"
 
 int tests_run = 0;
 
@@ -33,18 +40,48 @@ static char* test_suite()
     mu_run_test(test_lexer);
     printf("---=[ DJB2 tests\n");
     mu_run_test(test_djb2);
+    printf("---=[ Hash tests\n");
+    mu_run_test(test_hash);
+    printf("---=[ Symbol tests\n");
+    mu_run_test(test_symbol);
+    printf("---=[ String tests\n");
+    mu_run_test(test_string);
     printf("---=[ Map tests\n");
     mu_run_test(test_map);
-    printf("---=[ Primes tests\n");
-    mu_run_test(test_primes);
+    mu_run_test(test_map_grow);
+    mu_run_test(test_map_small);
+    mu_run_test(test_map_get_many);
+    mu_run_test(test_map_freeze);
+    mu_run_test(test_map_incremental_resize);
+    printf("---=[ Concurrent map tests\n");
+    mu_run_test(test_cmap);
+    mu_run_test(test_cmap_gc);
+    mu_run_test(test_cmap_threads);
     printf("---=[ Environment tests\n");
     mu_run_test(test_env);
+    mu_run_test(test_env_snapshot);
     printf("---=[ Array tests\n");
     mu_run_test(test_array);
     printf("---=[ List tests\n");
     mu_run_test(test_list);
+    printf("---=[ HAMT tests\n");
+    mu_run_test(test_hamt);
+    printf("---=[ B-tree tests\n");
+    mu_run_test(test_value_compare);
+    mu_run_test(test_value_immediates);
+    mu_run_test(test_btree);
+    mu_run_test(test_btree_from_sorted);
+    printf("---=[ Heap tests\n");
+    mu_run_test(test_heap);
+    mu_run_test(test_heap_static);
     printf("---=[ IR tests\n");
     mu_run_test(test_ir);
+    mu_run_test(test_ir_resolve);
+    printf("---=[ Eval tests\n");
+    mu_run_test(test_eval);
+    mu_run_test(test_eval_global);
+    mu_run_test(test_eval_snapshot);
+    mu_run_test(test_eval_strings);
     gc_stop(&gc);
     printf("---=[ GC tests\n");
     mu_run_test(test_gc_allocation_new_delete);
@@ -53,6 +90,11 @@ static char* test_suite()
     mu_run_test(test_gc_allocation_map_put_get_remove);
     mu_run_test(test_gc_mark_stack);
     mu_run_test(test_gc_basic_alloc_free);
+    mu_run_test(test_gc_profile);
+    mu_run_test(test_gc_trace);
+    mu_run_test(test_gc_stats);
+    mu_run_test(test_gc_heap);
+    mu_run_test(test_gc_fixed_heap);
     return 0;
 }
 
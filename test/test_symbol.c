@@ -0,0 +1,40 @@
+/*
+ * test_symbol.c
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "minunit.h"
+#include "symbol.h"
+#include "value.h"
+
+static char* test_symbol()
+{
+    char name[16] = "sum";
+    Symbol* sym = symbol_intern(name);
+    mu_assert(strcmp(sym->name, "sum") == 0, "Symbol must keep its name");
+    mu_assert(sym->length == 3, "Symbol must know its length");
+    mu_assert(sym->name != name, "Symbol must own its name");
+    mu_assert(symbol_intern("sum") == sym, "Equal names must intern to one symbol");
+    mu_assert(symbol_intern("sun") != sym, "Different names must not share a symbol");
+    mu_assert(symbol_intern("sum")->hash == sym->hash, "Hash must not change");
+
+    /* Symbols survive growing the table */
+    for (int i = 0; i < 1000; ++i) {
+        snprintf(name, sizeof(name), "sym%d", i);
+        symbol_intern(name);
+    }
+    mu_assert(symbol_intern("sum") == sym, "Interning must be stable");
+    mu_assert(symbol_intern("sym999") == symbol_intern("sym999"), "Interning must be stable");
+
+    /* Each symbol has one shared value */
+    Value* v = value_symbol(sym);
+    mu_assert(value_type(v) == VALUE_SYMBOL && v->value.symbol == sym,
+              "Value must name the symbol");
+    mu_assert(value_symbol(symbol_intern("sum")) == v, "Symbol values must be shared");
+    mu_assert(value_new_symbol("sum") != v, "New symbol values must not be shared");
+    return 0;
+}
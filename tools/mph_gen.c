@@ -0,0 +1,99 @@
+/*
+ * mph_gen.c
+ * Copyright (C) 2019 Marc Kirchner
+ *
+ * Distributed under terms of the MIT license.
+ *
+ * Build-time generator for frozen maps of builtins. Reads lines of the form
+ *
+ *     name function
+ *
+ * from stdin, where name is a symbol and function a builtin, computes a
+ * minimal perfect hash table over the symbol hashes and writes a header
+ * with the names, functions and bucket seeds for map_new_frozen() to
+ * stdout. Empty lines and lines starting with '#' are skipped.
+ *
+ * The table is only valid for the hash the generator was built with, so it
+ * must be compiled with the same HASH_* flags as the interpreter.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "mph.h"
+
+typedef struct Entry {
+    char name[128];
+    char fn[128];
+} Entry;
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s PREFIX < DEFINITIONS > HEADER\n", argv[0]);
+        return 2;
+    }
+    const char* prefix = argv[1];
+    char macro[128];
+    size_t len = strlen(prefix) < sizeof(macro) - 1 ? strlen(prefix) : sizeof(macro) - 1;
+    for (size_t i = 0; i < len; ++i) {
+        macro[i] = toupper((unsigned char) prefix[i]);
+    }
+    macro[len] = '\0';
+    Entry* entries = NULL;
+    size_t n = 0, capacity = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), stdin)) {
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') {
+            continue;
+        }
+        if (n == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            entries = realloc(entries, capacity * sizeof(Entry));
+        }
+        if (sscanf(line, "%127s %127s", entries[n].name, entries[n].fn) != 2) {
+            fprintf(stderr, "Malformed definition: %s", line);
+            return 1;
+        }
+        n++;
+    }
+
+    size_t nseeds = mph_buckets(n);
+    uint64_t* hashes = malloc((n ? n : 1) * sizeof(uint64_t));
+    uint32_t* seeds = malloc(nseeds * sizeof(uint32_t));
+    for (size_t i = 0; i < n; ++i) {
+        hashes[i] = hash_string(entries[i].name, strlen(entries[i].name));
+    }
+    if (mph_build(hashes, n, seeds, nseeds) != 0) {
+        fprintf(stderr, "No perfect hash for %zu names: %s\n", n, strerror(errno));
+        return 1;
+    }
+
+    printf("/* Generated by mph_gen, do not edit */\n\n");
+    printf("#define %s_SIZE %zu\n", macro, n);
+    printf("#define %s_SEEDS %zu\n\n", macro, nseeds);
+    printf("static const char* %s_names[] = {\n", prefix);
+    for (size_t i = 0; i < n; ++i) {
+        printf("    \"%s\",\n", entries[i].name);
+    }
+    printf("};\n\n");
+    printf("static Value* (*const %s_fns[])(Value*) = {\n", prefix);
+    for (size_t i = 0; i < n; ++i) {
+        printf("    %s,\n", entries[i].fn);
+    }
+    printf("};\n\n");
+    printf("static const uint32_t %s_seeds[] = {\n", prefix);
+    for (size_t b = 0; b < nseeds; ++b) {
+        printf("    %lu,\n", (unsigned long) seeds[b]);
+    }
+    printf("};\n");
+
+    free(seeds);
+    free(hashes);
+    free(entries);
+    return 0;
+}